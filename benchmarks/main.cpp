@@ -0,0 +1,115 @@
+#include <sonne/pch.hpp>
+
+#include <sonne/file.hpp>
+#include <sonne/config.hpp>
+#include <sonne/config_generator.hpp>
+#include <sonne/directory_counter.hpp>
+
+using namespace Sonne;
+
+/**
+ Create a directory, returning false only if it could not be created and does not already exist.
+ */
+inline bool MakeDirectory(const std::string& path)
+{
+#ifdef _WIN32
+    return CreateDirectoryA(path.c_str(), NULL) || GetLastError() == ERROR_ALREADY_EXISTS;
+#else
+    return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+#endif
+}
+
+/**
+ Fill a directory with the amount of files asked for, each of the size asked for, spread over subdirectories of a
+ thousand files so that no single directory gets too large.
+ */
+inline void GenerateTree(const std::string& root, size_t files, size_t fileSize)
+{
+    // a few short lines of code, a comment, and a blank line repeated until the file is the right size
+    std::string pattern = "int value = compute(input, 42);\n// update the running total\n\ntotal += value;\n";
+
+    std::string contents;
+
+    while (contents.size() < fileSize)
+    {
+        contents += pattern;
+    }
+
+    contents.resize(fileSize);
+
+    if (!MakeDirectory(root))
+    {
+        Fatal(fmt::format("Failed to create benchmark directory at: {}", root));
+    }
+
+    for (size_t index = 0; index < files; index++)
+    {
+        std::string directory = fmt::format("{}{}{}", root, Separator, index / 1000);
+
+        if (index % 1000 == 0 && !MakeDirectory(directory))
+        {
+            Fatal(fmt::format("Failed to create benchmark directory at: {}", directory));
+        }
+
+        std::ofstream out(fmt::format("{}{}{}.cpp", directory, Separator, index % 1000), std::ios::binary);
+
+        out.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+    }
+}
+
+/**
+ Count the tree once with the batch size passed in, printing how many files were counted a second.
+ */
+inline void RunCount(const std::string& root, size_t batchSize, size_t jobs)
+{
+    std::shared_ptr<Config> config = GenerateDefaultConfig();
+
+    config->SetBatchSize(batchSize);
+    config->SetJobs(jobs);
+
+    auto start = std::chrono::steady_clock::now();
+
+    DirectoryInfo info = DirectoryCounter(root, config).Run();
+
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    size_t files = info.totals.at("Totals").files;
+
+    fmt::print(
+        "batch size {: >8} | {: >8} files | {: >8.3f} s | {: >12.0f} files/s\n",
+        batchSize,
+        files,
+        elapsed.count(),
+        static_cast<double>(files) / elapsed.count());
+}
+
+/**
+ Benchmark for counting a tree of many tiny files, comparing a task per file to packing them into batches.
+
+ Usage: sonne_bench [directory] [files] [file size] [jobs]
+
+ The tree is only generated if the directory does not exist yet, so later runs skip straight to counting.
+ */
+int main(int argc, char** argv)
+{
+    std::string root = (argc > 1) ? argv[1] : "sonne_bench_tree";
+
+    size_t files    = (argc > 2) ? std::stoul(argv[2]) : 1000000;
+    size_t fileSize = (argc > 3) ? std::stoul(argv[3]) : 500;
+    size_t jobs     = (argc > 4) ? std::stoul(argv[4]) : 0;
+
+    if (!GetFSEntry(root).isValid)
+    {
+        fmt::print("Generating {} files of {} bytes in {}\n", files, fileSize, root);
+
+        GenerateTree(root, files, fileSize);
+    }
+
+    std::string fullPath = GetFSEntry(root).fullPath;
+
+    // a batch size of zero gives every file its own task, which is how files were counted before batching
+    RunCount(fullPath, 0, jobs);
+    RunCount(fullPath, GenerateDefaultConfig()->GetBatchSize(), jobs);
+
+    return 0;
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "sonne/counter.hpp"
+#include "sonne/scan.hpp"
+
+namespace Sonne
+{
+
+    struct Language;
+
+    /**
+     The kinds of tokens that a language automaton can match, used as bit flags.
+     */
+    enum TokenKind : uint8_t
+    {
+
+        TOKEN_STRING_DELIMITER = 1,
+        TOKEN_BLOCK_COMMENT_BEGIN = 2,
+        TOKEN_LINE_COMMENT = 4,
+        TOKEN_BLOCK_COMMENT_END = 8
+
+    };
+
+    /**
+     Every comment and string token of a language compiled into a single trie with a full transition table.
+
+     Matching the tokens that begin at an index walks the trie once, so each byte costs one table lookup no matter
+     how many delimiters the language defines. Built once per language when it is added to a config.
+     */
+    class LanguageAutomaton
+    {
+
+    public:
+
+        LanguageAutomaton(const Language& language);
+
+        /**
+         Return a mask of every token kind in `kinds` that begins at the index passed in.
+         */
+        inline uint8_t Match(const char* data, size_t index, size_t size, uint8_t kinds) const
+        {
+            uint8_t matched = 0;
+
+            size_t node = 0;
+
+            for (; index < size; index++)
+            {
+                node = m_transitions[(node << 8) | static_cast<uint8_t>(data[index])];
+
+                // stop once there is no edge or nothing further down this branch could match
+                if (node == 0 || (m_reachable[node] & kinds) == 0)
+                {
+                    break;
+                }
+
+                matched |= m_accepts[node];
+            }
+
+            return matched & kinds;
+        }
+
+        /**
+         The set of bytes that may begin a token that matters in the count state passed in.
+         */
+        inline const ScanSet& GetStops(CountState state) const
+        {
+            return m_stops[static_cast<size_t>(state)];
+        }
+
+        /**
+         Whether the language has any token of the kind passed in.
+         */
+        inline bool HasKind(TokenKind kind) const
+        {
+            return (m_reachable[0] & kind) != 0;
+        }
+
+        /**
+         The length of the longest token, which is the furthest that a match can look ahead.
+         */
+        inline size_t GetMaxTokenLength() const
+        {
+            return m_maxTokenLength;
+        }
+
+        /**
+         The token kinds that need to be checked for while in the count state passed in.
+         */
+        static uint8_t GetKindsForState(CountState state);
+
+    private:
+
+        // transition table indexed by node * 256 + byte, zero is the root and signals that there is no edge
+        std::vector<uint32_t> m_transitions;
+
+        // the token kinds that end at each node
+        std::vector<uint8_t> m_accepts;
+
+        // the token kinds that end at each node or at any node below it
+        std::vector<uint8_t> m_reachable;
+
+        ScanSet m_stops[4];
+
+        size_t m_maxTokenLength = 0;
+
+        void _AddToken(const std::string& token, TokenKind kind);
+
+    };
+
+}
\ No newline at end of file
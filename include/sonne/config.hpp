@@ -3,6 +3,10 @@
 namespace Sonne
 {
 
+    class LanguageAutomaton;
+
+    class IgnoreMatcher;
+
     /**
      Structure containing information on how to read a specific language using
      based on its extension. Contains information such as comment tokens.
@@ -21,6 +25,17 @@ namespace Sonne
         // a list of strings for defining strings in the corresponding language. used for validating comments.
         std::vector<std::string> stringDelimiters;
 
+        // every token above compiled into one automaton, built when the language is added to a config
+        std::shared_ptr<LanguageAutomaton> automaton = nullptr;
+
+        // a hash of the name and every token, which changes whenever the way this language is counted does
+        uint64_t hash = 0;
+
+        /**
+         Compile the comment and string tokens into the automaton used by the counter, and hash them.
+         */
+        void Compile();
+
     };
 
     /**
@@ -47,12 +62,23 @@ namespace Sonne
 
         inline void AddLanguage(std::shared_ptr<Language> language)
         {
+            language->Compile();
+
             for (auto& extension : language->extensions)
             {
                 this->m_languages.insert(std::make_pair(extension, language));
             }
         }
 
+        /**
+         Add every language of another config for the extensions that this one does not have a language for yet,
+         leaving everything else about this config as it is.
+         */
+        inline void AddLanguages(const Config& other)
+        {
+            m_languages.insert(other.m_languages.begin(), other.m_languages.end());
+        }
+
         inline void SetColumns(size_t columns)
         {
             this->m_columns = columns;
@@ -63,6 +89,97 @@ namespace Sonne
             return m_columns;
         }
 
+        inline void SetJobs(size_t jobs)
+        {
+            this->m_jobs = jobs;
+        }
+
+        /**
+         The amount of worker threads to count with, zero means to use the default job count.
+         */
+        inline size_t GetJobs() const
+        {
+            return m_jobs;
+        }
+
+        inline void SetLinesOnly(bool linesOnly)
+        {
+            this->m_linesOnly = linesOnly;
+        }
+
+        /**
+         Whether to only count total and empty lines, skipping the comment and string parsing of each language.
+         */
+        inline bool GetLinesOnly() const
+        {
+            return m_linesOnly;
+        }
+
+        inline void SetStreamThreshold(size_t threshold)
+        {
+            this->m_streamThreshold = threshold;
+        }
+
+        /**
+         Files at or above this size are counted in chunks rather than being held in memory all at once.
+         */
+        inline size_t GetStreamThreshold() const
+        {
+            return m_streamThreshold;
+        }
+
+        inline void SetChunkSize(size_t size)
+        {
+            this->m_chunkSize = size;
+        }
+
+        /**
+         The amount of bytes read at a time when streaming a file.
+         */
+        inline size_t GetChunkSize() const
+        {
+            return m_chunkSize;
+        }
+
+        inline void SetParallelThreshold(size_t threshold)
+        {
+            this->m_parallelThreshold = threshold;
+        }
+
+        /**
+         Files at or above this size are split into segments that are counted on several workers at once.
+         */
+        inline size_t GetParallelThreshold() const
+        {
+            return m_parallelThreshold;
+        }
+
+        inline void SetSegmentSize(size_t size)
+        {
+            this->m_segmentSize = size;
+        }
+
+        /**
+         The target size of each segment when a file is counted in parallel.
+         */
+        inline size_t GetSegmentSize() const
+        {
+            return m_segmentSize;
+        }
+
+        inline void SetBatchSize(size_t size)
+        {
+            this->m_batchSize = size;
+        }
+
+        /**
+         The amount of bytes worth of small files that are packed into a single task when counting a directory.
+         */
+        inline size_t GetBatchSize() const
+        {
+            return m_batchSize;
+        }
+
         inline void SetIgnoreHidden(bool state)
         {
             this->m_ignoreHidden = state;
@@ -73,9 +190,88 @@ namespace Sonne
             return m_ignoreHidden;
         }
 
+        inline void SetGitIgnore(bool state)
+        {
+            this->m_gitIgnore = state;
+        }
+
+        /**
+         Whether `.gitignore` files, `.git/info/exclude` and the global excludes file of git are followed in a walk.
+         */
+        inline bool GetGitIgnore() const
+        {
+            return m_gitIgnore;
+        }
+
+        inline void SetUseGitIndex(bool state)
+        {
+            this->m_useGitIndex = state;
+        }
+
+        /**
+         Whether the files tracked in the index of a git repository are counted instead of walking the directory.
+         */
+        inline bool GetUseGitIndex() const
+        {
+            return m_useGitIndex;
+        }
+
+        inline void SetFollowSymlinks(bool state)
+        {
+            this->m_followSymlinks = state;
+        }
+
+        /**
+         Whether links to directories are walked into, with every file and directory only counted the first time it
+         is reached by any path.
+         */
+        inline bool GetFollowSymlinks() const
+        {
+            return m_followSymlinks;
+        }
+
+        inline void SetDedupe(bool state)
+        {
+            this->m_dedupe = state;
+        }
+
+        /**
+         Whether files with the same contents as a file counted earlier in the run reuse its count.
+         */
+        inline bool GetDedupe() const
+        {
+            return m_dedupe;
+        }
+
+        inline void SetCachePath(const std::string& path)
+        {
+            this->m_cachePath = path;
+        }
+
+        /**
+         The file that counts are cached in between runs, blank when nothing is cached.
+         */
+        inline const std::string& GetCachePath() const
+        {
+            return m_cachePath;
+        }
+
         inline void AddIgnored(std::string path, bool ignore)
         {
             m_ignored.insert(std::make_pair(path, ignore));
+
+            _CompileIgnored();
+        }
+
+        /**
+         Every ignore rule compiled into a single matcher, or nullptr when nothing is ignored.
+
+         The map of ignores has no order, so negated rules are always added after the rest and win over them.
+         Changes made through GetIgnored are not compiled, AddIgnored should be used instead.
+         */
+        inline const IgnoreMatcher* GetIgnoreMatcher() const
+        {
+            return m_ignoreMatcher.get();
         }
 
         inline std::map<std::string, std::shared_ptr<Language>>& GetLanguages()
@@ -88,18 +284,55 @@ namespace Sonne
             return m_ignored;
         }
 
+        inline const std::map<std::string, bool>& GetIgnored() const
+        {
+            return m_ignored;
+        }
+
     private:
 
         std::map<std::string, std::shared_ptr<Language>> m_languages;
 
         std::map<std::string, bool> m_ignored;
 
+        // shared between copies of the config, as it is never changed once compiled
+        std::shared_ptr<const IgnoreMatcher> m_ignoreMatcher = nullptr;
+
         bool m_ignoreHidden = true;
 
+        bool m_gitIgnore = true;
+
+        bool m_useGitIndex = false;
+
+        bool m_followSymlinks = false;
+
+        std::string m_cachePath = "";
+
+        bool m_dedupe = false;
+
         size_t m_columns = 80;
 
+        size_t m_jobs = 0;
+
+        bool m_linesOnly = false;
+
+        size_t m_streamThreshold = 64 * 1024 * 1024;
+
+        size_t m_chunkSize = 1024 * 1024;
+
+        size_t m_parallelThreshold = 32 * 1024 * 1024;
+
+        size_t m_segmentSize = 8 * 1024 * 1024;
+
+        size_t m_batchSize = 1024 * 1024;
+
         nlohmann::json _ConstructConfigJSON();
 
+        /**
+         Rebuild the ignore matcher from every ignore in the config.
+         */
+        void _CompileIgnored();
+
     };
 
 }
\ No newline at end of file
@@ -0,0 +1,111 @@
+#pragma once
+
+namespace Sonne
+{
+
+    struct CountInfo;
+
+    /**
+     Hash the contents of a file with 64 bit xxHash (XXH64), which runs many times faster than counting the lines.
+     */
+    uint64_t HashContent(const char* data, size_t size, uint64_t seed=0);
+
+    /**
+     The counts of every file read in a run, looked up by the hash of its contents.
+
+     A file with the same contents, size and way of being counted as one counted before it, such as a vendored copy
+     of a library, reuses that count instead of being scanned again. Like the identity set, the table is split into
+     shards that each have their own lock so workers can look up and add at the same time.
+     */
+    class ContentTable
+    {
+
+    public:
+
+        /**
+         Find the count of a file with the same contents, filling in the line counts of the info passed in.
+
+         Returns false if no file like it was counted yet. The language and counting mode of the info are expected
+         to be set already, as they are part of what the count key is made from.
+         */
+        bool Find(uint64_t hash, size_t size, uint64_t countKey, CountInfo& info);
+
+        /**
+         Keep the count of a file for any later file with the same contents.
+         */
+        void Add(uint64_t hash, size_t size, uint64_t countKey, const CountInfo& info);
+
+        /**
+         The amount of files that reused the count of another file.
+         */
+        inline size_t GetDuplicates() const
+        {
+            return m_duplicates;
+        }
+
+        /**
+         The amount of bytes that did not have to be scanned for reusing the count of another file.
+         */
+        inline size_t GetBytesSaved() const
+        {
+            return m_bytesSaved;
+        }
+
+    private:
+
+        static constexpr size_t ShardCount = 64;
+
+        struct Key
+        {
+
+            uint64_t hash;
+
+            uint64_t size;
+
+            uint64_t countKey; // the language and counting mode, as the same bytes count differently in another
+
+            inline bool operator==(const Key& other) const
+            {
+                return hash == other.hash && size == other.size && countKey == other.countKey;
+            }
+
+        };
+
+        struct KeyHash
+        {
+
+            inline size_t operator()(const Key& key) const
+            {
+                return static_cast<size_t>(key.hash ^ key.countKey);
+            }
+
+        };
+
+        // files counted from a view are always smaller than the stream threshold, so 32 bits is plenty for each count
+        struct Lines
+        {
+
+            uint32_t total;
+            uint32_t empty;
+            uint32_t code;
+            uint32_t comment;
+
+        };
+
+        struct Shard
+        {
+
+            std::mutex mutex;
+
+            std::unordered_map<Key, Lines, KeyHash> counts;
+
+        };
+
+        Shard m_shards[ShardCount];
+
+        std::atomic<size_t> m_duplicates { 0 };
+        std::atomic<size_t> m_bytesSaved { 0 };
+
+    };
+
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include "sonne/counter.hpp"
+#include "sonne/file.hpp"
+#include "sonne/hash.hpp"
+
+namespace Sonne
+{
+
+    class Config;
+
+    /**
+     What a file looked like when the walk found it, which has to match exactly for a cached count to be used.
+     */
+    struct FileStamp
+    {
+
+        uint64_t fileSize = 0;
+
+        int64_t modifiedTime = 0; // zero when the walk did not look it up, which is never cached
+
+        uint64_t inode = 0;
+
+    };
+
+    /**
+     A single cached count, stored in the cache file exactly as laid out here.
+     */
+    struct CacheRecord
+    {
+
+        uint64_t pathHash;   // of the path relative to the root
+        uint64_t configHash; // of the language the file was counted as and anything else that changes a count
+
+        uint64_t fileSize;
+        int64_t  modifiedTime;
+        uint64_t inode;
+
+        uint64_t totalLines;
+        uint64_t emptyLines;
+        uint64_t codeLines;
+        uint64_t commentLines;
+
+        uint32_t language; // index into the language names stored after the records
+        uint32_t flags;
+
+    };
+
+    /**
+     The counts made by one worker during a run, kept to be written into the next cache.
+     */
+    class CacheUpdate
+    {
+
+    public:
+
+        void Add(uint64_t pathHash, uint64_t configHash, const FileStamp& stamp, const CountInfo& info);
+
+        inline size_t GetSize() const
+        {
+            return m_records.size();
+        }
+
+    private:
+
+        friend class CountCache;
+
+        std::vector<CacheRecord> m_records;
+
+        // a run only ever sees a handful of languages, so these are found by a plain search
+        std::vector<std::string> m_languages;
+
+    };
+
+    /**
+     Counts of files from an earlier run, looked up by the path of each file and what it looked like back then.
+
+     The file is a fixed header followed by records sorted by path hash, so loading it is a single map and a lookup
+     is a binary search straight into the mapping. A new cache is written to a temporary file and renamed over the
+     old one, so a run reading the cache never sees a half written file. Numbers are stored in the byte order of the
+     machine, so a cache is only meant to be used on the machine that wrote it.
+     */
+    class CountCache
+    {
+
+    public:
+
+        // bumped whenever counting changes in a way that makes older counts wrong
+        static constexpr uint32_t Version = 1;
+
+        /**
+         Load the cache file written for the root passed in. Returns false and leaves the cache empty if there is no
+         file, or it was written for another root or by another version.
+         */
+        bool Load(const std::string& path, const std::string& root);
+
+        /**
+         Find the count of a file, returning false unless the file and the way it is counted are both unchanged.
+         */
+        bool Find(uint64_t pathHash, uint64_t configHash, const FileStamp& stamp, CountInfo& info) const;
+
+        inline size_t GetSize() const
+        {
+            return m_recordCount;
+        }
+
+        /**
+         Unmap the cache file, which is needed before a new cache can be renamed over it on windows.
+         */
+        void Close();
+
+        /**
+         Hash everything in the config that changes the count of a file at the path, which is the language its
+         extension maps to and whether only lines are counted.
+         */
+        static uint64_t GetConfigHash(const Config& config, const std::string& path);
+
+        /**
+         Write every count made in a run as the new cache for the root, replacing the old file all at once.
+
+         Files changed within a second of the run starting are left out, as a change made right after they were
+         counted could keep the same modified time on filesystems with coarse timestamps.
+         */
+        static bool Write(
+            const std::string& path,
+            const std::string& root,
+            const std::vector<CacheUpdate>& updates,
+            int64_t startTime);
+
+    private:
+
+        struct Header
+        {
+
+            char magic[8];
+
+            uint32_t version;
+            uint32_t languageCount;
+
+            uint64_t recordCount;
+            uint64_t rootHash;
+
+            uint64_t languagesOffset; // where the language names start, each one a 32 bit length and its bytes
+
+            uint64_t reserved[3];
+
+        };
+
+        ReadBuffer m_buffer;
+
+        FileView m_view;
+
+        const CacheRecord* m_records = nullptr;
+
+        size_t m_recordCount = 0;
+
+        std::vector<std::string> m_languages;
+
+    };
+
+}
@@ -5,6 +5,18 @@ namespace Sonne
 
     struct Language;
 
+    class LanguageAutomaton;
+
+    class FileStream;
+
+    class ReadBuffer;
+
+    class ContentTable;
+
+    class ThreadPool;
+
+    struct SegmentJob;
+
     class Config;
 
     struct CountInfo
@@ -19,6 +31,8 @@ namespace Sonne
         size_t      codeLines = 0;
         size_t      commentLines = 0;
 
+        bool        linesOnly = false; // code and comment lines were not computed, only total and empty lines
+
         CountInfo() = default;
 
         CountInfo(
@@ -46,6 +60,22 @@ namespace Sonne
             this->codeLines += info.codeLines;
             this->commentLines += info.commentLines;
 
+            this->linesOnly = this->linesOnly || info.linesOnly;
+
+            return *this;
+        }
+
+        /**
+         Take a count that was added before back out, such as a file that has since changed or been deleted.
+         */
+        CountInfo& operator-=(const CountInfo& info)
+        {
+            this->files -= std::min(this->files, info.files);
+            this->totalLines -= std::min(this->totalLines, info.totalLines);
+            this->emptyLines -= std::min(this->emptyLines, info.emptyLines);
+            this->codeLines -= std::min(this->codeLines, info.codeLines);
+            this->commentLines -= std::min(this->commentLines, info.commentLines);
+
             return *this;
         }
 
@@ -78,9 +108,14 @@ namespace Sonne
 
         std::shared_ptr<Language> language = nullptr;
 
+        // the compiled tokens for the language, or a token-less automaton for plain text
+        const LanguageAutomaton* automaton = nullptr;
+
         CountInfo& info;
 
-        std::vector<char>& buffer;
+        const char* buffer = nullptr;
+
+        size_t size = 0;
 
         CountData(
             size_t lineLength,
@@ -91,7 +126,8 @@ namespace Sonne
             bool wasBlockComment,
             std::shared_ptr<Language> language,
             CountInfo& info,
-            std::vector<char>& buffer
+            const char* buffer,
+            size_t size
         )
             :
             lineLength(lineLength),
@@ -102,7 +138,8 @@ namespace Sonne
             wasBlockComment(wasBlockComment),
             language(language),
             info(info),
-            buffer(buffer)
+            buffer(buffer),
+            size(size)
         {
         }
     
@@ -120,55 +157,181 @@ namespace Sonne
         /**
          Create a counter for the file at the current path.
          */
-        Counter(const std::string& path);
+        Counter(std::string path);
+
+        /**
+         Create a counter for a file that the caller has already looked at, such as from a directory walk.
+
+         The file size is trusted so the file is never stat'd again. When a directory handle is passed in, the file is
+         opened relative to it using the part of the path starting at `nameOffset`, skipping the path lookup as well.
+
+         When the size is not exact, such as one from a git index, it is only used to decide how to read the file and
+         is checked once the file is open. A file that no longer exists is then counted as nothing, not an error.
+
+         The path is borrowed rather than copied, so a worker can count every file from the one string it reuses. It
+         has to outlive the counter.
+         */
+        Counter(const std::string& path, size_t fileSize, int directory=-1, size_t nameOffset=0, bool exactSize=true);
+
+        Counter(const Counter&) = delete;
+
+        Counter& operator=(const Counter&) = delete;
 
         /**
          Return a FileInfo struct relating to the metrics of the countable file.
          
-         Pass in a config for language support.
+         Pass in a config for language support. When a pool is passed in, files above the parallel threshold of the
+         config are split up and counted on the workers of that pool as well as the calling thread.
+
+         The buffer is borrowed to read the file into, and should be owned by the worker running the count so that it
+         is reused from file to file. Without one a buffer is allocated just for this count.
+
+         When a content table is passed in, a file read in one go is hashed first, and takes the count of an
+         identical file counted before it instead of being scanned. Files large enough to be streamed are always
+         scanned.
          */
-        CountInfo Count(std::shared_ptr<Config> config);
+        CountInfo Count(
+            const std::shared_ptr<Config>& config,
+            ThreadPool* pool=nullptr,
+            ReadBuffer* buffer=nullptr,
+            ContentTable* contents=nullptr);
+
+        /**
+         Try and grab a file extension from the path specified.
+         */
+        static std::string GetExtension(const std::string& path);
 
     private:
 
+        /*
+        The path given to the counter when it keeps a copy of its own, otherwise left empty.
+        */
+        std::string m_ownedPath = "";
+
         /*
         Path to the file that is currently being counted.
         */
-        std::string m_path = "";
+        const std::string& m_path;
+
+        /*
+        Metadata for the file when it came from the caller, letting the count skip looking the file up again.
+        */
+        bool m_hasMetadata = false;
+
+        size_t m_fileSize = 0;
+
+        int m_directory = -1;
+
+        size_t m_nameOffset = 0;
+
+        bool m_exactSize = true;
 
         /**
-         Try and grab a file extension from the path specified.
+         Path to open the file with, which is relative to the directory handle when there is one.
+         */
+        const char* _GetOpenPath() const;
+
+
+        /**
+         Grab the compiled automaton for a language, or one without any tokens when there is no language.
          */
-        std::string _GetExtension(const std::string& path);
+        std::shared_ptr<const LanguageAutomaton> _GetAutomaton(std::shared_ptr<Language> language);
 
         /**
-         Grab a lookahead character for a buffer, while checking if the lookahead is valid.
-         
-         If an invalid lookahead is found, a null character is returned.
+         Count every line in a buffer holding the whole file and update the info passed in.
+
+         When no language is given this just counts all newlines in the file.
          */
-        char _GetBufferLookahead(std::vector<char>& buffer, const size_t& index);
+        void _CountFromBuffer(
+            const char* buffer,
+            size_t size,
+            std::shared_ptr<Language> language,
+            CountInfo& info);
 
         /**
-         Used when no language info is found for the file to be counted.
+         Count a file by reading it in chunks, carrying the count state across each chunk.
 
-         Just counts all newlines in the file and updates the info passed in.
+         Only the chunk size is ever held in memory. The last few bytes of each chunk are held back and counted with
+         the next one, so tokens that straddle a boundary are matched the same as when counting from one buffer.
          */
-        void _CountFromBuffer(std::vector<char>& buffer, std::shared_ptr<Language> language, CountInfo& info);
+        void _CountFromStream(
+            FileStream& stream,
+            std::shared_ptr<Language> language,
+            CountInfo& info,
+            ReadBuffer& buffer,
+            size_t chunkSize);
 
-        /*
-        Method for checking if any language-oriented attributes are set when a newline is found
-        */
-        void _LanguageNewLineCheck(CountData& data);
+        /**
+         Count the bytes of a file in the range given by streaming them through the buffer in chunks.
 
-        /*
-        Checks if a string matches with a portion of the buffer passed in.
-        */
-        bool _CompareStringToBuffer(std::vector<char>& buffer, std::string& compare, const size_t& start);
+         Bytes past the end of the range are still read to look ahead for tokens, so a range counts the same as it
+         would as part of the whole file.
+         */
+        void _CountStreamRange(
+            CountData& data,
+            FileStream& stream,
+            size_t begin,
+            size_t end,
+            ReadBuffer& buffer,
+            size_t chunkSize);
+
+        /**
+         Split a file into roughly even segments that each begin right after a newline.
+
+         Returns the offset of each segment with the file size as the last entry.
+         */
+        std::vector<size_t> _FindSegmentBounds(FileStream& stream, size_t segments);
+
+        /**
+         Count one segment of a file for one of the states it could be entered in.
+         */
+        void _CountSegmentUnit(
+            SegmentJob& job,
+            size_t unit,
+            FileStream& stream,
+            std::shared_ptr<Language> language,
+            std::shared_ptr<const LanguageAutomaton> automaton,
+            ReadBuffer& buffer,
+            size_t chunkSize);
+
+        /**
+         Count a large file by splitting it into segments and counting them across the pool.
+
+         The state at the start of a segment is unknown until the segment before it is counted, so each segment is
+         counted speculatively for every state it could be entered in. The results are then stitched together by
+         following the exit state of each segment, which matches counting the whole file serially.
+         */
+        void _CountInParallel(
+            FileStream& stream,
+            std::shared_ptr<Language> language,
+            CountInfo& info,
+            ThreadPool& pool,
+            std::shared_ptr<Config> config,
+            ReadBuffer& buffer);
+
+        /**
+         Run the count state machine over the bytes in the range of the data buffer.
+
+         Bytes past the end of the range up to the buffer size are only used to look ahead for tokens.
+         */
+        void _CountRange(CountData& data, size_t begin, size_t end);
+
+        /**
+         Count only the total and empty lines in the range, used when there is no language to parse tokens for.
+
+         Lines are found with the scan kernel, which also keeps track of whether each line has anything but whitespace.
+         */
+        void _CountLines(CountData& data, size_t begin, size_t end);
+
+        /**
+         Count the last line of a file, as there is no newline at the end of it to trigger the count.
+         */
+        void _FinishCount(CountData& data);
 
         /*
-        Check if the buffer has a string delimiter at the current index in the buffer.
+        Method for checking if any language-oriented attributes are set when a newline is found
         */
-        bool _CheckStringDelimiter(std::vector<char>& buffer, std::vector<std::string>& delimiters, const size_t& start);
+        void _LanguageNewLineCheck(CountData& data);
 
         /*
         Method for setting state based on config comment and string definitions.
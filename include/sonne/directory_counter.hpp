@@ -1,21 +1,117 @@
 #pragma once
 
 #include "sonne/counter.hpp"
+#include "sonne/count_cache.hpp"
 
 namespace Sonne
 {
 
     class Config;
 
+    class ThreadPool;
+
     struct Entry;
 
+    struct WalkJob;
+
+    struct IgnoreScope;
+
+    class IgnoreMatcher;
+
     struct DirectoryInfo
     {
 
         std::map<std::string, CountInfo> totals;
+
+        size_t walkedEntries = 0; // the amount of files and directories kept from the walk
+        size_t walkMemory    = 0; // the amount of bytes used to keep them
+        size_t walkSyscalls  = 0; // the amount of calls into the filesystem made to walk
+
+        bool fromGitIndex = false; // whether the files came from the index of a git repository instead of a walk
+
+        size_t duplicates = 0; // the amount of links and hard links skipped for leading somewhere already walked
+
+        bool usedCache   = false; // whether counts were looked up in a cache from an earlier run
+        size_t cacheHits = 0;     // the amount of files whose count came from the cache instead of reading them
+
+        size_t dedupedFiles = 0; // the amount of files that reused the count of an identical file
+        size_t dedupedBytes = 0; // the amount of bytes those files did not have to be scanned for
+
+        size_t listedFiles = 0; // the amount of paths read from a list of files instead of walking
+
+        /**
+         Add a count to the running total for the language of that count.
+         */
+        inline void Add(const CountInfo& count)
+        {
+            auto find = totals.find(count.language);
+
+            // if this language has occurred before just append to the counts, otherwise insert the first count
+            if (find != totals.end())
+            {
+                find->second += count;
+            }
+            else
+            {
+                totals.insert(std::make_pair(count.language, count));
+            }
+        }
     
     };
 
+    /**
+     A group of files that are counted together as a single task, so that tiny files do not each pay for scheduling.
+     */
+    struct CountBatch
+    {
+
+        // every file also costs this many bytes on top of its size, for the cost of opening it
+        static constexpr size_t FileCost = 4096;
+
+        // the config as it was when these files were walked, which nothing else changes while they are counted
+        std::shared_ptr<Config> config = nullptr;
+
+        // the index of each file in the tree of the walk
+        std::vector<uint32_t> files;
+
+        // the path of each file when they came from a list rather than a walk, which is used in place of the tree
+        std::vector<std::string> paths;
+
+        // what each file looked like when the walk found it, only kept when there is a cache to check against
+        std::vector<FileStamp> stamps;
+
+        size_t cost = 0;
+
+        /**
+         Add a file to the batch, returning true once the batch has reached the budget and should be counted.
+
+         A file larger than the budget fills a batch on its own, while thousands of tiny files share one.
+         */
+        inline bool Add(uint32_t file, size_t fileSize, size_t budget)
+        {
+            files.push_back(file);
+
+            cost += fileSize + FileCost;
+
+            return cost >= budget;
+        }
+
+        /**
+         Add a file by its path rather than its place in a tree, returning true once the batch should be counted.
+
+         The size of a listed file is not known until it is counted, so it only costs as much as opening it.
+         */
+        inline bool Add(std::string path, size_t budget)
+        {
+            paths.push_back(std::move(path));
+
+            cost += FileCost;
+
+            return cost >= budget;
+        }
+
+    };
+
     /**
      Takes in a path to a directory and tries to walk that directory, counting
      each file that it finds for lines.
@@ -25,10 +121,88 @@ namespace Sonne
 
     public:
 
+        /**
+         Called with the full path and count of each file counted in a run, on whichever worker counted it.
+         */
+        using FileVisitor = std::function<void(const std::string& path, const CountInfo& count)>;
+
+        /**
+         Called with the full path of each directory a walk reads, along with the config and ignore rules that apply to
+         the entries inside of it, on whichever worker read it.
+         */
+        using DirectoryVisitor = std::function<void(
+            const std::string& path,
+            const std::shared_ptr<Config>& config,
+            const std::shared_ptr<const IgnoreScope>& ignores)>;
+
         DirectoryCounter(const std::string& path, std::shared_ptr<Config> config);
 
+        /**
+         Walk the directory and count every file in it.
+
+         Each directory is read as its own task on the worker pool, with subdirectories going onto a queue rather than
+         being recursed into. Files are handed off to the workers in batches as soon as the walk finds them, so
+         counting runs alongside the walk rather than waiting for the whole tree to be listed first.
+
+         A config found in a directory applies to everything below that directory, while the languages it adds are
+         used for every file in the walk. Unless turned off in the config, `.gitignore` files apply the same way, along
+         with the excludes of any repository that the walk is in.
+
+         When set in the config, the files tracked in the git index are counted instead of walking the directory.
+         Following links walks into links to directories as well, and every file and directory is then only taken
+         the first time it is found by its device and inode, which breaks loops and skips hard linked copies.
+
+         With a cache path set, a file that looks the same as it did in the last run is not read again, and its
+         count is taken from the cache. The cache is replaced with the counts of this run once it is over.
+         */
         DirectoryInfo Run();
 
+        /**
+         Count every file in a list of paths rather than walking the directory, such as the output of
+         `git ls-files -z` or `find -print0`.
+
+         Paths are split by NULs if the first path ends with one, otherwise by new lines, and relative paths are taken
+         from the current directory. Files are sent off to be counted as they are read rather than once the whole list
+         is in, and any path that is not a regular file is skipped when it comes up. A listed file is counted the same
+         as if the walk had found it, with the config at the root of the directory, but is never skipped for being
+         hidden or ignored as the list already says what to count.
+         */
+        DirectoryInfo RunFromList(std::istream& list);
+
+        /**
+         Set what is called for each file counted by a run, which has to be safe to call from many workers at once.
+         */
+        inline void SetFileVisitor(FileVisitor visitor)
+        {
+            m_fileVisitor = std::move(visitor);
+        }
+
+        /**
+         Set what is called for each directory read by a walk, which has to be safe to call from many workers at once.
+
+         A directory is visited before any of its entries are read, and directories are not visited when the files
+         come from a git index.
+         */
+        inline void SetDirectoryVisitor(DirectoryVisitor visitor)
+        {
+            m_directoryVisitor = std::move(visitor);
+        }
+
+        /**
+         Set a pool for every run to count on instead of making its own, so that something running many counts keeps
+         a single set of workers. The pool has to outlive the counter, and nullptr goes back to a pool per run.
+         */
+        inline void SetPool(ThreadPool* pool)
+        {
+            m_pool = pool;
+        }
+
+        /**
+         Whether an entry below the root would be skipped by a walk, given the config and ignore rules that apply to
+         the directory it is in.
+         */
+        bool IsSkipped(const Entry& entry, const Config& config, const IgnoreScope* ignores=nullptr);
+
         /**
          Walk through entries to grab paths to append to the second vector.
 
@@ -51,5 +225,67 @@ namespace Sonne
 
         std::shared_ptr<Config> m_config;
 
+        FileVisitor m_fileVisitor;
+
+        DirectoryVisitor m_directoryVisitor;
+
+        ThreadPool* m_pool = nullptr; // a pool shared between runs, when one is set
+
+        /**
+         Whether an entry found in the walk should be skipped, from being hidden, a config, or matching an ignore.
+
+         A directory that is skipped is never opened, so nothing below it is looked at.
+         */
+        bool _ShouldSkip(const Entry& entry, const Config& config, size_t& ignored, const IgnoreScope* ignores=nullptr);
+
+        /**
+         Read a single directory of the walk on a worker, queueing up its subdirectories and batching up its files.
+
+         The config and ignore rules passed in are the ones that apply to the parent of this directory.
+         */
+        void _WalkDirectory(
+            WalkJob& job,
+            uint32_t directory,
+            std::shared_ptr<Config> config,
+            std::shared_ptr<const IgnoreScope> ignores,
+            size_t worker);
+
+        /**
+         Load the ignore rules from the directories above the root, when the root is inside of a git repository.
+
+         Returns nullptr if the root is not inside of a repository, or if it is the top of one.
+         */
+        std::shared_ptr<const IgnoreScope> _GetParentIgnores(const IgnoreMatcher& global);
+
+        /**
+         List the files tracked in the index of the repository the root is in, instead of walking the directory.
+
+         Runs on the calling thread before any walk is submitted, so it fills the batch slot of the first worker, and
+         waits for the workers to catch up whenever too many batches are queued.
+         Returns false without adding anything if the root is not in a repository or the index could not be read.
+         */
+        bool _ReadGitIndex(WalkJob& job, uint32_t root);
+
+        /**
+         Send a file found by the walk off to be counted, or hold it until the end if no language is known for it yet.
+         */
+        void _QueueFile(
+            WalkJob& job,
+            uint32_t node,
+            const std::string& name,
+            const FileStamp& stamp,
+            const std::shared_ptr<Config>& config,
+            size_t worker);
+
+        /**
+         Add the totals of every worker into the info, along with the sum of every language under `Totals`.
+         */
+        void _MergeTotals(WalkJob& job, DirectoryInfo& info);
+
+        /**
+         Hand the batch that the worker has been filling up off to the pool to be counted.
+         */
+        void _SubmitBatch(WalkJob& job, size_t worker);
+
     };
 }
\ No newline at end of file
@@ -22,11 +22,19 @@ namespace Sonne
 
         bool isHidden = false; // this attribute only really matters on windows
 
+        bool isSymlink = false; // only known when the listing gives the type of each entry
+
         std::string fullPath = "";
         std::string fileName = ""; // only used for GetNextEntry calls
 
         size_t fileSize = 0;
 
+        // the device and inode of what the entry points to, which are left at zero when not looked up
+        uint64_t device = 0;
+        uint64_t inode  = 0;
+
+        int64_t modifiedTime = 0; // in nanoseconds since the unix epoch, zero when not looked up
+
 #ifdef _WIN32
         HANDLE windowsHandle = nullptr;
 #else
@@ -67,4 +75,262 @@ namespace Sonne
      */
     std::vector<Entry> WalkDirectory(std::string path);
 
+    /**
+     Reads the entries of a single directory, skipping anything that cannot be counted.
+
+     On linux the directory is read with getdents64 in large blocks, into a buffer that is kept between directories.
+     Directories are never stat'd, and FIFOs, sockets and device nodes are skipped without a stat as opening one can
+     block forever. Other platforms read through GetNextEntry.
+     */
+    class DirectoryReader
+    {
+
+    public:
+
+        DirectoryReader() = default;
+
+        ~DirectoryReader();
+
+        DirectoryReader(const DirectoryReader&) = delete;
+
+        DirectoryReader& operator=(const DirectoryReader&) = delete;
+
+        /**
+         Open the directory at the path, returning false if it could not be opened.
+
+         When a directory descriptor is given the part of the path starting at `nameOffset` is opened relative to it,
+         which is ignored on platforms without the lean reader.
+         */
+        bool Open(const std::string& path, int directory=-1, size_t nameOffset=0);
+
+        /**
+         Read the next entry into the entry passed in, returning false once there are none left.
+         */
+        bool Next(Entry& entry);
+
+        /**
+         Whether the directory has an entry with the name passed in, which should be asked before reading entries.
+
+         This is answered from the listing itself when the whole directory fit into the first read.
+         */
+        bool Contains(const char* name);
+
+        void Close();
+
+        /**
+         Walk into links to directories instead of skipping them, which otherwise only links to files are followed.
+         */
+        inline void SetFollowLinks(bool state)
+        {
+            m_followLinks = state;
+        }
+
+        /**
+         Look up the device and inode of the open directory, returning false if it could not be found.
+         */
+        bool GetIdentity(uint64_t& device, uint64_t& inode);
+
+        /**
+         The amount of calls into the filesystem made by this reader so far, which is a count of system calls on
+         linux and of directory reads and stats everywhere else.
+         */
+        inline size_t GetSyscalls() const
+        {
+            return m_syscalls;
+        }
+
+    private:
+
+        std::string m_path;
+
+        size_t m_syscalls = 0;
+
+        bool m_followLinks = false;
+
+#ifdef __linux__
+        static constexpr size_t BufferSize = 128 * 1024;
+
+        // reading stops once less than this is left in the buffer, which always fits at least one more entry
+        static constexpr size_t MinimumRead = 4096;
+
+        std::unique_ptr<char[]> m_buffer = nullptr;
+
+        int m_directory = -1;
+
+        size_t m_offset = 0; // where the next entry starts in the buffer
+        size_t m_size = 0;   // how much of the buffer holds entries
+
+        bool m_complete = false; // the end of the directory has been read
+        bool m_whole = false;    // the whole directory fit into the first read
+
+        /**
+         Refill the buffer with as many entries as fit, returning false if the read failed.
+         */
+        bool _Read();
+#else
+        Entry m_first;
+
+        bool m_open = false;
+#endif
+
+    };
+
+    /**
+     A growable block of memory for reading files into, which is reused between reads.
+
+     Unlike a vector, growing the buffer does not zero fill the new memory as it is about to be overwritten.
+     */
+    class ReadBuffer
+    {
+
+    public:
+
+        /**
+         Make sure the buffer can hold at least the size passed in, returning a pointer to the start of it.
+         */
+        char* Reserve(size_t size);
+
+        inline size_t GetCapacity() const
+        {
+            return m_capacity;
+        }
+
+    private:
+
+        std::unique_ptr<char[]> m_data = nullptr;
+
+        size_t m_capacity = 0;
+
+    };
+
+    /**
+     A file opened for reading at arbitrary offsets, used to stream through files too large to hold in memory.
+     */
+    class FileStream
+    {
+
+    public:
+
+        FileStream() = default;
+
+        ~FileStream();
+
+        FileStream(const FileStream&) = delete;
+
+        FileStream& operator=(const FileStream&) = delete;
+
+        /**
+         Open the file at the path, returning false if it could not be opened.
+
+         When a directory descriptor is given the path is opened relative to it, which is ignored on windows.
+         */
+        bool Open(const std::string& path, int directory=-1);
+
+        void Close();
+
+        /**
+         Read up to size bytes starting at the offset into the destination, setting the amount actually read.
+
+         Less than size is only read when the end of the file is hit. Returns false if the read failed.
+         */
+        bool ReadAt(char* destination, size_t size, size_t offset, size_t& read);
+
+        inline size_t GetSize() const
+        {
+            return m_size;
+        }
+
+    private:
+
+        size_t m_size = 0;
+
+#ifdef _WIN32
+        HANDLE m_file = INVALID_HANDLE_VALUE;
+#else
+        int m_file = -1;
+#endif
+
+    };
+
+    /**
+     A read-only view of the contents of a file.
+
+     Files at or above the map threshold are memory mapped and read directly from the page cache, anything smaller is
+     read into the buffer passed in, as mapping a small file costs more than copying it.
+     */
+    class FileView
+    {
+
+    public:
+
+        static constexpr size_t DefaultMapThreshold = 256 * 1024;
+
+        FileView() = default;
+
+        ~FileView();
+
+        FileView(const FileView&) = delete;
+
+        FileView& operator=(const FileView&) = delete;
+
+        /**
+         Open the file at the path, returning false if it could not be opened or read.
+         */
+        bool Open(const std::string& path, ReadBuffer& buffer, size_t mapThreshold=DefaultMapThreshold);
+
+        /**
+         Open a file with a size that is already known, such as from the directory walk, skipping the stat.
+
+         When a directory descriptor is given the path is opened relative to it, so the kernel does not have to
+         resolve the whole path again. Windows has no relative opens, so the path has to be a full path there.
+
+         A size that is not exact, such as one from a git index, is checked against the open file instead.
+         */
+        bool Open(
+            const char* path,
+            size_t fileSize,
+            ReadBuffer& buffer,
+            size_t mapThreshold=DefaultMapThreshold,
+            int directory=-1,
+            bool exactSize=true);
+
+        /**
+         Unmap the file if it was mapped, the view is empty after this.
+         */
+        void Close();
+
+        inline const char* GetData() const
+        {
+            return m_data;
+        }
+
+        inline size_t GetSize() const
+        {
+            return m_size;
+        }
+
+        inline bool IsMapped() const
+        {
+            return m_mapped;
+        }
+
+    private:
+
+        const char* m_data = nullptr;
+
+        size_t m_size = 0;
+
+        bool m_mapped = false;
+
+#ifdef _WIN32
+        HANDLE m_mapping = nullptr;
+#else
+        /**
+         Map or read the whole of an open file descriptor, closing it once done.
+         */
+        bool _ReadDescriptor(int file, size_t size, ReadBuffer& buffer, size_t mapThreshold);
+#endif
+
+    };
+
 }
\ No newline at end of file
@@ -0,0 +1,168 @@
+#pragma once
+
+namespace Sonne
+{
+
+    /**
+     A compact tree of every entry found in a walk, stored as flat blocks of small nodes rather than full paths.
+
+     Each node holds the index of its parent and a reference to its name, with names interned so a name that shows up
+     in many directories (like `index.js` or `CMakeLists.txt`) is only stored once. Full paths are rebuilt from the
+     chain of parents when they are needed, so a walk costs a few tens of bytes per entry.
+
+     Entries can be added from many threads at once. Nodes and names live in blocks that never move once allocated,
+     so reading an entry never takes a lock, as long as the reader learned about the entry through something that
+     synchronizes with the thread that added it, such as a task queue.
+     */
+    class FileTree
+    {
+
+    public:
+
+        static constexpr uint32_t NoParent = 0xFFFFFFFF;
+
+        /**
+         An entry waiting to be added to the tree with the rest of the entries in its directory.
+         */
+        struct Pending
+        {
+
+            std::string name;
+
+            size_t fileSize;
+
+            bool isDirectory;
+
+        };
+
+        FileTree();
+
+        ~FileTree();
+
+        FileTree(const FileTree&) = delete;
+
+        FileTree& operator=(const FileTree&) = delete;
+
+        /**
+         Add the root of the tree, which holds the whole path to the directory being walked as its name.
+         */
+        uint32_t AddRoot(const std::string& path);
+
+        /**
+         Add every entry passed in as a child of the parent, returning the index of the first one.
+
+         The entries are given consecutive indices in the order they were passed in. Adding entries a chunk at a time
+         keeps the lock that guards the tree from being taken for every single entry.
+         */
+        uint32_t AddChildren(uint32_t parent, const std::vector<Pending>& children);
+
+        inline uint32_t GetParent(uint32_t node) const
+        {
+            return _GetNode(node).parent;
+        }
+
+        inline size_t GetFileSize(uint32_t node) const
+        {
+            return static_cast<size_t>(_GetNode(node).fileSize);
+        }
+
+        inline bool IsDirectory(uint32_t node) const
+        {
+            return _GetNode(node).isDirectory != 0;
+        }
+
+        /**
+         Rebuild the full path of a node into the string passed in, reusing its memory when it is large enough.
+         */
+        void GetPath(uint32_t node, std::string& path) const;
+
+        /**
+         The amount of entries in the tree, including the root.
+         */
+        size_t GetSize() const;
+
+        /**
+         The amount of bytes allocated for the tree, including space set aside for entries that have not been added.
+         */
+        size_t GetMemoryUsage() const;
+
+    private:
+
+        struct Node
+        {
+
+            uint32_t parent;
+
+            uint32_t name; // offset of the name in the name blocks
+
+            uint16_t nameLength;
+
+            uint8_t isDirectory;
+
+            uint64_t fileSize;
+
+        };
+
+        static constexpr size_t NodeBlockShift = 12;
+        static constexpr size_t NodeBlockSize  = size_t(1) << NodeBlockShift;
+
+        static constexpr size_t NameBlockShift = 16;
+        static constexpr size_t NameBlockSize  = size_t(1) << NameBlockShift;
+
+        // tables of pointers to each block, swapped for a larger copy when full so readers never see one move
+        std::atomic<Node**> m_nodeTable;
+        std::atomic<char**> m_nameTable;
+
+        // everything below is only touched while holding the lock
+        mutable std::mutex m_mutex;
+
+        std::vector<std::unique_ptr<Node[]>> m_nodeBlocks;
+        std::vector<std::unique_ptr<char[]>> m_nameBlocks;
+
+        // tables that have been replaced, kept around as a reader may still be looking through one
+        std::vector<std::unique_ptr<Node*[]>> m_nodeTables;
+        std::vector<std::unique_ptr<char*[]>> m_nameTables;
+
+        size_t m_nodeTableCapacity = 0;
+        size_t m_nameTableCapacity = 0;
+
+        size_t m_nodeCount = 0;
+
+        // where the next name is written, as an offset into the name blocks
+        size_t m_nameEnd = 0;
+
+        // open addressed set of every name stored, packed as the name offset and its length
+        std::vector<uint64_t> m_interned;
+
+        size_t m_internedCount = 0;
+
+        inline const Node& _GetNode(uint32_t node) const
+        {
+            return m_nodeTable.load(std::memory_order_acquire)[node >> NodeBlockShift][node & (NodeBlockSize - 1)];
+        }
+
+        inline const char* _GetName(uint32_t offset) const
+        {
+            return m_nameTable.load(std::memory_order_acquire)[offset >> NameBlockShift] + (offset & (NameBlockSize - 1));
+        }
+
+        /**
+         Add a node to the end of the tree, expecting the lock to be held.
+         */
+        uint32_t _AddNode(uint32_t parent, const char* name, size_t length, size_t fileSize, bool isDirectory);
+
+        /**
+         Find the name in the interned names or store it if it is new, expecting the lock to be held.
+         */
+        uint32_t _InternName(const char* name, size_t length);
+
+        /**
+         Copy a name into the name blocks, starting a new block if it does not fit at the end of the current one.
+         */
+        uint32_t _StoreName(const char* name, size_t length);
+
+        void _GrowInterned();
+
+    };
+
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+namespace Sonne
+{
+
+    /**
+     A file tracked in the index of a git repository.
+     */
+    struct GitIndexEntry
+    {
+
+        const char* path = nullptr; // relative to the top of the work tree, always split with forward slashes
+
+        size_t pathLength = 0;
+
+        // the size when the file was last staged, which is cut to 32 bits and may be stale if it changed since
+        size_t fileSize = 0;
+
+        uint32_t mode = 0;
+
+    };
+
+    /**
+     Find the git directory of a work tree, following the `gitdir:` line of a `.git` file for linked work trees and
+     submodules. Returns a blank string if the path is not the top of a work tree.
+     */
+    std::string FindGitDirectory(const std::string& workTree);
+
+    /**
+     Read the entries of a git index file, calling the visitor for each regular file in the work tree in path order.
+
+     Versions 2 through 4 of the index format are read directly, with SHA-1 or SHA-256 object names depending on the
+     repository. Conflicted paths are only visited once, and symlinks, submodules and paths outside of a sparse
+     checkout are skipped. The path handed to the visitor is only valid until it returns.
+
+     Returns false if the file could not be read or is not an index this understands, such as a split index.
+     */
+    bool ReadGitIndex(const std::string& gitDirectory, const std::function<void(const GitIndexEntry&)>& visitor);
+
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+namespace Sonne
+{
+
+    /**
+     Hash a run of bytes with 64 bit FNV-1a, carrying on from the hash passed in so several runs can be chained.
+     */
+    inline uint64_t HashBytes(const char* data, size_t size, uint64_t hash=0xCBF29CE484222325ull)
+    {
+        for (size_t index = 0; index < size; index++)
+        {
+            hash ^= static_cast<unsigned char>(data[index]);
+
+            hash *= 0x100000001B3ull;
+        }
+
+        return hash;
+    }
+
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+namespace Sonne
+{
+
+    /**
+     A set of the files and directories already seen in a walk, by the device and inode they live on.
+
+     Hard links, bind mounts and links that lead back to somewhere already walked all share the same identity, so
+     only the first path to reach one keeps it. The set is split into shards that each have their own lock, so many
+     workers can insert at once without waiting on each other most of the time.
+     */
+    class IdentitySet
+    {
+
+    public:
+
+        /**
+         Add an identity to the set, returning false if it was already in the set.
+         */
+        bool Insert(uint64_t device, uint64_t inode);
+
+        /**
+         Take an identity back out of the set, such as once the only path that led to it is gone.
+         */
+        void Erase(uint64_t device, uint64_t inode);
+
+        /**
+         The amount of identities in the set, which takes every lock.
+         */
+        size_t GetSize() const;
+
+    private:
+
+        static constexpr size_t ShardCount = 64;
+
+        struct Identity
+        {
+
+            uint64_t device;
+
+            uint64_t inode;
+
+            inline bool operator==(const Identity& other) const
+            {
+                return device == other.device && inode == other.inode;
+            }
+
+        };
+
+        struct IdentityHash
+        {
+
+            inline size_t operator()(const Identity& identity) const
+            {
+                // inodes are mostly sequential, so mix the bits before they pick a bucket
+                uint64_t hash = (identity.inode ^ (identity.device << 32) ^ identity.device) * 0x9E3779B97F4A7C15ull;
+
+                return static_cast<size_t>(hash ^ (hash >> 29));
+            }
+
+        };
+
+        struct Shard
+        {
+
+            mutable std::mutex mutex;
+
+            std::unordered_set<Identity, IdentityHash> identities;
+
+        };
+
+        Shard m_shards[ShardCount];
+
+    };
+
+}
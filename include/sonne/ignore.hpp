@@ -0,0 +1,126 @@
+#pragma once
+
+namespace Sonne
+{
+
+    /**
+     The outcome of matching a path against a set of ignore rules.
+     */
+    enum class IgnoreResult
+    {
+
+        NONE,     // no rule matched the path
+        IGNORED,  // the last rule to match ignores the path
+        INCLUDED  // the last rule to match is a negation, which takes the path back
+
+    };
+
+    /**
+     A set of ignore rules compiled once, which paths are matched against while walking.
+
+     Rules follow the syntax of a `.gitignore` line. `*` and `?` match within a single part of a path, `**` matches
+     across any amount of directories, `[...]` matches a class of characters and `\` escapes the next character.
+     A rule ending in `/` only matches directories, and a rule starting with `!` takes back a path that an earlier
+     rule ignored. A rule with a `/` anywhere but the end is matched against the whole path relative to where the
+     rules apply, anything else is matched against the name of each entry at any depth.
+
+     Patterns always use `/` to split directories, which matches the separator of the platform in paths.
+     */
+    class IgnoreMatcher
+    {
+
+    public:
+
+        /**
+         Compile a rule and add it after every rule added before, blank lines and comments are skipped.
+
+         When more than one rule matches a path, the one added last wins.
+         */
+        void Add(const std::string& pattern);
+
+        /**
+         Add every line of an ignore file as a rule, such as a `.gitignore`, returning false if it could not be read.
+         */
+        bool AddFile(const std::string& path);
+
+        /**
+         Match a path relative to where the rules apply against every rule, without allocating.
+         */
+        IgnoreResult Match(const char* path, size_t length, bool isDirectory) const;
+
+        inline bool IsIgnored(const char* path, size_t length, bool isDirectory) const
+        {
+            return Match(path, length, isDirectory) == IgnoreResult::IGNORED;
+        }
+
+        inline bool IsEmpty() const
+        {
+            return m_rules.empty();
+        }
+
+        inline size_t GetSize() const
+        {
+            return m_rules.size();
+        }
+
+    private:
+
+        enum class RuleKind
+        {
+
+            LITERAL, // no wildcards at all, compared byte for byte
+            SUFFIX,  // a single `*` followed by plain text, such as `*.log`
+            GLOB     // anything else, matched with the full glob matcher
+
+        };
+
+        struct Rule
+        {
+
+            std::string pattern; // with the negation, anchoring slash and trailing slash removed
+
+            RuleKind kind = RuleKind::GLOB;
+
+            bool negated = false;
+
+            bool directoryOnly = false;
+
+            bool anchored = false; // matched against the whole path rather than only the name
+
+        };
+
+        std::vector<Rule> m_rules;
+
+    };
+
+    /**
+     The ignore rules that belong to one directory, chained to the rules of the directories above it.
+
+     Rules from a deeper directory win over the rules above, the same as nested `.gitignore` files. Scopes are shared
+     by every directory below the one that made them and never changed once made, so they can be read from any
+     thread.
+     */
+    struct IgnoreScope
+    {
+
+        std::shared_ptr<const IgnoreScope> parent = nullptr;
+
+        IgnoreMatcher matcher;
+
+        // the length of the full path of the directory these rules apply from, including the separator after it
+        size_t baseLength = 0;
+
+        /**
+         Match a full path against this scope and every scope above it, stopping at the first that decides.
+         */
+        IgnoreResult Match(const std::string& fullPath, bool isDirectory) const;
+
+    };
+
+    /**
+     Find the global excludes file of git, from `core.excludesFile` in the git config of the user or the default
+     location under the config home. Returns a blank string if there is no home directory to look in.
+     */
+    std::string GetGlobalExcludesPath();
+
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+namespace Sonne
+{
+
+    /**
+     A small set of bytes that the scan kernel will stop on, such as newlines or the first byte of a comment token.
+
+     Sets are kept small so that the vector kernels can compare every byte in the set against a whole block at once.
+     Adding more than `MaxBytes` distinct bytes marks the set as overflowed, in which case it should not be scanned.
+     */
+    struct ScanSet
+    {
+
+        static constexpr size_t MaxBytes = 8;
+
+        uint8_t bytes[MaxBytes] = {};
+
+        size_t count = 0;
+
+        bool overflowed = false;
+
+        inline bool Contains(char byte) const
+        {
+            for (size_t index = 0; index < count; index++)
+            {
+                if (bytes[index] == static_cast<uint8_t>(byte))
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        inline void Add(char byte)
+        {
+            if (Contains(byte))
+            {
+                return;
+            }
+
+            if (count == MaxBytes)
+            {
+                overflowed = true;
+
+                return;
+            }
+
+            bytes[count] = static_cast<uint8_t>(byte);
+
+            count++;
+        }
+
+    };
+
+    /**
+     The kernels that the scan can run with, from the plain loop that runs anywhere to the widest vector blocks.
+     */
+    enum class ScanKernel : uint8_t
+    {
+
+        SCALAR = 0,
+        SSE2 = 1,
+        AVX2 = 2
+
+    };
+
+    /**
+     Scan forward in the data from start until the first byte that is in the stop set, returning that index.
+
+     If no stop byte is found before end, end is returned. Every byte skipped over that is not a space or a tab is
+     added to `nonBlank`, allowing line lengths to be kept without looking at each byte.
+     */
+    size_t ScanToStop(const char* data, size_t start, size_t end, const ScanSet& stops, size_t& nonBlank);
+
+    /**
+     Scan the same as `ScanToStop`, but with the kernel given rather than the one picked for this cpu, so that every
+     kernel can be checked against the others. A kernel that this cpu does not support falls back to the scalar one.
+     */
+    size_t ScanToStopWith(
+        ScanKernel kernel,
+        const char* data,
+        size_t start,
+        size_t end,
+        const ScanSet& stops,
+        size_t& nonBlank);
+
+    /**
+     Whether a kernel can run on this cpu, which the scalar kernel always can.
+     */
+    bool IsScanKernelSupported(ScanKernel kernel);
+
+    /**
+     Name of the scan kernel that was picked for this cpu, either "avx2", "sse2", or "scalar".
+     */
+    const char* GetScanKernelName();
+
+}
\ No newline at end of file
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "sonne/watcher.hpp"
+
+namespace Sonne
+{
+
+    class Config;
+
+    /**
+     Serves the counts of a directory to other programs over a local socket, keeping everything needed to answer
+     resident between queries so each one is only a lookup.
+
+     The directory is counted once when the server starts, with the count of every file and the totals of every
+     directory kept by a watcher. On linux the counts are kept up to date as files change, while anywhere else they
+     stay as they were when the server started. Queries are answered on the same thread that applies changes, so an
+     answer never sees part of a burst of changes.
+
+     Every message in either direction is a frame of a 4 byte big endian length followed by that many bytes of JSON.
+     A request names a query and a path, which is either absolute or relative to the directory being served:
+
+         { "query": "totals", "path": "source" }
+
+     `totals` answers with the sum of every file at or below the path, `languages` with that sum broken down by
+     language as well, and `file` with the count of a single file. Each answer has `ok` set, along with `error` when
+     the query could not be answered.
+     */
+    class Server
+    {
+
+    public:
+
+        // the largest request that is read, anything larger closes the connection
+        static constexpr size_t MaxFrame = 64 * 1024;
+
+        Server(const std::string& socketPath, const std::string& path, std::shared_ptr<Config> config);
+
+        ~Server();
+
+        Server(const Server&) = delete;
+
+        Server& operator=(const Server&) = delete;
+
+        /**
+         Count the directory and start listening on the socket, returning false if the socket could not be made or a
+         server is already listening on it.
+         */
+        bool Start();
+
+        /**
+         Wait up to the timeout in milliseconds for connections, requests or changes to the directory, handling
+         whatever is ready. A negative timeout waits until something happens.
+         */
+        void Serve(int timeout);
+
+        /**
+         Answer a single request, the same as if it came in over the socket.
+         */
+        std::string Answer(const std::string& request) const;
+
+        inline const Watcher& GetWatcher() const
+        {
+            return m_watcher;
+        }
+
+        /**
+         Send a request to the server listening at the socket path and wait for its answer, returning false if the
+         server could not be reached.
+         */
+        static bool Query(const std::string& socketPath, const std::string& request, std::string& response);
+
+        /**
+         Whether this platform has local sockets to serve over.
+         */
+        static bool IsSupported();
+
+    private:
+
+        /**
+         A connection to the server, with whatever has been read of the next request and not yet sent of answers.
+         */
+        struct Client
+        {
+
+            int socket;
+
+            std::string input;
+
+            std::string output;
+
+        };
+
+        std::string m_socketPath;
+
+        Watcher m_watcher;
+
+        int m_socket = -1;
+
+        std::vector<Client> m_clients;
+
+        /**
+         Read what a client has sent and answer every whole request in it, returning false once it should be closed.
+         */
+        bool _Receive(Client& client);
+
+        /**
+         Send as much of the answers waiting for a client as it will take, returning false once it should be closed.
+         */
+        bool _Send(Client& client);
+
+        /**
+         Turn a path from a request into the full path that counts are kept by.
+         */
+        std::string _Resolve(const std::string& path) const;
+
+    };
+
+}
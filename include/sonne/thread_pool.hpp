@@ -0,0 +1,129 @@
+#pragma once
+
+namespace Sonne
+{
+
+    /**
+     Grab the amount of worker threads that should be used when no job count is given.
+
+     Starts with the hardware thread count, then clamps that down to the cpus the process is allowed to run on and
+     the cpu quota of the cgroup that it lives in, so containerized runners are not oversubscribed.
+     */
+    size_t GetDefaultJobCount();
+
+    /**
+     A fixed size pool of worker threads, each with its own queue of tasks.
+
+     Workers run the tasks in their own queue in the order they were submitted, and once it is empty steal the next
+     task from the queues of the other workers. Used for running counting work without creating a thread for every
+     file, and without every worker fighting over a single lock.
+     */
+    class ThreadPool
+    {
+
+    public:
+
+        /**
+         Create a pool with the amount of workers specified, zero uses the default job count.
+         */
+        ThreadPool(size_t workers=0);
+
+        /**
+         Waits for any remaining tasks to complete and then joins all workers.
+         */
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool&) = delete;
+
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        /**
+         Queue a task to be run on the next available worker.
+
+         The task is passed the index of the worker running it, which is always less than the pool size. This
+         allows callers to keep per-worker state without any locking.
+         */
+        void Submit(std::function<void(size_t)> task);
+
+        /**
+         Queue a task onto the queue of a specific worker, which any idle worker may still steal it from.
+         */
+        void Submit(std::function<void(size_t)> task, size_t worker);
+
+        /**
+         Block the calling thread until every submitted task has finished running.
+         */
+        void Wait();
+
+        /**
+         Block the calling thread until there are fewer than `limit` tasks queued or running.
+
+         Lets a producer keep the pool busy without queueing up work faster than it can be ran. This should not be
+         called from a worker, as it may end up waiting on itself.
+         */
+        void WaitForRoom(size_t limit);
+
+        inline size_t GetSize() const
+        {
+            return m_workers.size();
+        }
+
+        /**
+         The amount of tasks waiting in a queue that no worker has started yet, which is zero whenever a worker is
+         about to go idle.
+         */
+        inline size_t GetQueued() const
+        {
+            return m_queued.load(std::memory_order_relaxed);
+        }
+
+    private:
+
+        struct WorkerQueue
+        {
+
+            std::mutex mutex;
+
+            std::deque<std::function<void(size_t)>> tasks;
+
+        };
+
+        std::vector<std::thread> m_workers;
+
+        std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+
+        // the total amount of tasks sitting in every queue, only changed while holding the lock of that queue
+        std::atomic<size_t> m_queued;
+
+        // the queue that the next task without a worker is placed on
+        std::atomic<size_t> m_nextQueue;
+
+        std::mutex m_mutex;
+
+        // signaled when a task is queued or the pool is stopping
+        std::condition_variable m_taskReady;
+
+        // signaled when the last pending task finishes, or any task finishes while a producer is waiting for room
+        std::condition_variable m_idle;
+
+        // the amount of tasks that are either queued or currently being ran
+        size_t m_pending = 0;
+
+        // the amount of threads blocked in WaitForRoom
+        size_t m_roomWaiters = 0;
+
+        bool m_stopping = false;
+
+        /**
+         Loop ran on each worker thread, pulling tasks until the pool is stopped.
+         */
+        void _WorkerLoop(size_t worker);
+
+        /**
+         Grab the next task from the queue of the worker, or steal one from another worker if that queue is empty.
+         */
+        bool _TakeTask(size_t worker, std::function<void(size_t)>& task);
+
+    };
+
+}
\ No newline at end of file
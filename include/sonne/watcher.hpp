@@ -0,0 +1,246 @@
+#pragma once
+
+#include "sonne/directory_counter.hpp"
+#include "sonne/identity_set.hpp"
+#include "sonne/ignore.hpp"
+
+namespace Sonne
+{
+
+    class Config;
+
+    class ThreadPool;
+
+    class ReadBuffer;
+
+    /**
+     Keeps the totals of a directory up to date as files in it change, without counting the whole directory again.
+
+     The directory is counted once as a normal walk, keeping the count of every file and a watch on every directory
+     read. After that only the files that the watches report as changed are counted again, with the old count of a
+     file taken out of the totals before its new one is added, and deleted files only taken out. Changes come in
+     bursts, such as when switching branches, so they are gathered until things settle before anything is counted.
+
+     A change to a `.sonne.json` or `.gitignore` can change what every file below it counts as, so it starts the
+     whole count over instead, the same as when the kernel drops changes because too many came in at once.
+
+     Watching uses inotify, so it is only supported on linux. The files always come from a walk, even when the config
+     asks for the git index, as files that are not tracked yet still change. When links are followed, a file or
+     directory that shows up again through a link or hard link is only counted the first time, the same as a walk.
+     */
+    class Watcher
+    {
+
+    public:
+
+        // how long to wait for the next change of a burst before counting what has changed so far
+        static constexpr int SettleTime = 50;
+
+        // the longest a burst is gathered for, so a file that keeps changing still shows up in the totals
+        static constexpr int MaxDelay = 1000;
+
+        Watcher(const std::string& path, std::shared_ptr<Config> config);
+
+        ~Watcher();
+
+        Watcher(const Watcher&) = delete;
+
+        Watcher& operator=(const Watcher&) = delete;
+
+        /**
+         Count the whole directory and start watching every directory in it, dropping anything watched before.
+         */
+        const DirectoryInfo& Start();
+
+        /**
+         Wait up to the timeout in milliseconds for something to change, then count what changed once the burst it
+         is part of has settled. A negative timeout waits until something changes.
+
+         Returns true if anything changed, after which the totals reflect the directory as it is now.
+         */
+        bool Update(int timeout);
+
+        inline const DirectoryInfo& GetInfo() const
+        {
+            return m_info;
+        }
+
+        /**
+         The amount of directories being watched right now.
+         */
+        inline size_t GetWatchCount() const
+        {
+            return m_directories.size();
+        }
+
+        /**
+         The amount of files and directories that changed in the last update.
+         */
+        inline size_t GetChangedFiles() const
+        {
+            return m_changedFiles;
+        }
+
+        /**
+         How long the last update spent counting once the changes settled, in microseconds.
+         */
+        inline int64_t GetUpdateTime() const
+        {
+            return m_updateTime;
+        }
+
+        /**
+         The amount of files that have a count kept for them.
+         */
+        inline size_t GetFileCount() const
+        {
+            return m_files.size();
+        }
+
+        /**
+         Fill in the totals of every file at or below a path, by language and with the sum of every language under
+         `Totals`, the same as a count of just that path. Returns false if nothing is counted at or below the path.
+
+         Totals are kept for every directory as files change, so this never looks at the files themselves.
+         */
+        bool GetTotals(const std::string& path, DirectoryInfo& info) const;
+
+        /**
+         Look up the count of a single file by its full path, returning false if the file is not counted.
+         */
+        bool GetFile(const std::string& path, CountInfo& count) const;
+
+        /**
+         The full path of the directory being watched.
+         */
+        inline const std::string& GetPath() const
+        {
+            return m_path;
+        }
+
+        /**
+         The descriptor that becomes readable when something has changed, or -1 when nothing is being watched, so
+         waiting for changes can be done alongside waiting on other things.
+         */
+        inline int GetDescriptor() const
+        {
+            return m_inotify;
+        }
+
+        /**
+         Whether changes can be watched for on this platform at all.
+         */
+        static bool IsSupported();
+
+    private:
+
+        /**
+         A directory being watched, with the config and ignore rules that apply to the entries inside of it.
+         */
+        struct WatchedDirectory
+        {
+
+            std::string path;
+
+            std::shared_ptr<Config> config;
+
+            std::shared_ptr<const IgnoreScope> ignores;
+
+        };
+
+        std::string m_path;
+
+        // the config as it was given, which each full count starts from as counting adds the configs it finds
+        std::shared_ptr<Config> m_baseConfig;
+
+        std::shared_ptr<Config> m_config;
+
+        std::unique_ptr<DirectoryCounter> m_counter;
+
+        // the global excludes of git, which apply from the top of every repository that shows up
+        IgnoreMatcher m_globalIgnores;
+
+        // the workers of every full count, which large files that changed are still split up across when counted again
+        std::unique_ptr<ThreadPool> m_pool;
+
+        std::unique_ptr<ReadBuffer> m_buffer;
+
+        DirectoryInfo m_info;
+
+        // the count that each file currently adds to the totals, by its full path
+        std::unordered_map<std::string, CountInfo> m_files;
+
+        // the totals of every file below each directory by language, by the full path of the directory
+        std::unordered_map<std::string, std::map<std::string, CountInfo>> m_folders;
+
+        // the device and inode of every file counted and directory watched when links are followed, along with the
+        // identity each path took so it can be given back once the path is gone
+        std::unique_ptr<IdentitySet> m_identities;
+        std::unordered_map<std::string, std::pair<uint64_t, uint64_t>> m_identityPaths;
+
+        // every directory being watched by its watch descriptor, and the other way around by its path
+        std::unordered_map<int, WatchedDirectory> m_directories;
+        std::unordered_map<std::string, int> m_watches;
+
+        // guards the maps while the first count fills them in from the workers
+        std::mutex m_mutex;
+
+        int m_inotify = -1;
+
+        bool m_warned = false; // whether running out of watches has been reported yet
+
+        size_t m_changedFiles = 0; // the amount of files looked at again in the last update
+
+        int64_t m_updateTime = 0; // how long the last update took to count, in microseconds
+
+        /**
+         Start watching a directory, expecting the lock to be held when workers could be running.
+         */
+        void _Watch(
+            const std::string& path,
+            const std::shared_ptr<Config>& config,
+            const std::shared_ptr<const IgnoreScope>& ignores);
+
+        /**
+         Stop watching a directory and everything below it, taking every file below it out of the totals.
+         */
+        void _Forget(const std::string& path);
+
+        /**
+         Walk a directory that showed up after the first count, watching it and counting everything in it the same
+         way the walk would have. The config and ignore rules passed in are the ones that apply to its parent.
+         */
+        void _AddDirectory(
+            const std::string& path,
+            std::shared_ptr<Config> config,
+            std::shared_ptr<const IgnoreScope> ignores);
+
+        /**
+         Count a file again, or take it out of the totals if it is gone or should no longer be counted.
+         */
+        void _UpdateFile(const std::string& path, const WatchedDirectory& directory);
+
+        /**
+         Swap the count kept for a file for a new one in the totals, taking it out when the new count is nullptr.
+         */
+        void _SetCount(const std::string& path, const CountInfo* count);
+
+        /**
+         Take the identity of a file or directory for its path when links are followed, returning false if another
+         path already has it and it should be skipped. Always true when links are not followed.
+         */
+        bool _Claim(const std::string& path, uint64_t device, uint64_t inode);
+
+        /**
+         Give back the identity a path took, once it is no longer counted or watched.
+         */
+        void _Release(const std::string& path);
+
+        /**
+         Add a count of a file to, or take it out of, the totals of every directory from the root down to the file.
+         */
+        void _AddToFolders(const std::string& path, const CountInfo& count, bool remove);
+
+    };
+
+}
@@ -0,0 +1,96 @@
+#include "sonne/pch.hpp"
+#include "sonne/automaton.hpp"
+
+#include "sonne/config.hpp"
+
+using namespace Sonne;
+
+LanguageAutomaton::LanguageAutomaton(const Language& language)
+    :
+    m_transitions(256, 0),
+    m_accepts(1, 0),
+    m_reachable(1, 0)
+{
+    // newlines and carriage returns are handled the same way in every state
+    for (size_t state = 0; state < 4; state++)
+    {
+        m_stops[state].Add('\n');
+        m_stops[state].Add('\r');
+    }
+
+    for (auto& delimiter : language.stringDelimiters)
+    {
+        // an empty delimiter used to compare its null terminator to the buffer, so keep matching that way
+        _AddToken(delimiter.empty() ? std::string(1, '\0') : delimiter, TOKEN_STRING_DELIMITER);
+    }
+
+    if (!language.blockCommentBegin.empty())
+    {
+        _AddToken(language.blockCommentBegin, TOKEN_BLOCK_COMMENT_BEGIN);
+    }
+
+    if (!language.lineComment.empty())
+    {
+        _AddToken(language.lineComment, TOKEN_LINE_COMMENT);
+    }
+
+    if (!language.blockCommentEnd.empty())
+    {
+        _AddToken(language.blockCommentEnd, TOKEN_BLOCK_COMMENT_END);
+    }
+}
+
+uint8_t LanguageAutomaton::GetKindsForState(CountState state)
+{
+    switch (state)
+    {
+    case CountState::NORMAL:
+        return TOKEN_STRING_DELIMITER | TOKEN_BLOCK_COMMENT_BEGIN | TOKEN_LINE_COMMENT;
+    case CountState::STRING:
+        return TOKEN_STRING_DELIMITER;
+    case CountState::BLOCK_COMMENT:
+        return TOKEN_BLOCK_COMMENT_END;
+    default:
+        return 0; // nothing can end a line comment other than a newline
+    }
+}
+
+void LanguageAutomaton::_AddToken(const std::string& token, TokenKind kind)
+{
+    size_t node = 0;
+
+    m_reachable[0] |= kind;
+
+    for (char current : token)
+    {
+        size_t edge = (node << 8) | static_cast<uint8_t>(current);
+
+        if (m_transitions[edge] == 0)
+        {
+            // create a new node with an empty row of transitions
+            m_transitions[edge] = static_cast<uint32_t>(m_accepts.size());
+
+            m_transitions.resize(m_transitions.size() + 256, 0);
+
+            m_accepts.push_back(0);
+            m_reachable.push_back(0);
+        }
+
+        node = m_transitions[edge];
+
+        m_reachable[node] |= kind;
+    }
+
+    m_accepts[node] |= kind;
+
+    m_maxTokenLength = std::max(m_maxTokenLength, token.size());
+
+    // the first byte of the token is where the scan kernel has to stop for every state that checks this kind
+    for (size_t state = 0; state < 4; state++)
+    {
+        if (GetKindsForState(static_cast<CountState>(state)) & kind)
+        {
+            m_stops[state].Add(token[0]);
+        }
+    }
+}
\ No newline at end of file
@@ -1,8 +1,27 @@
 #include "sonne/pch.hpp"
 #include "sonne/config.hpp"
+#include "sonne/automaton.hpp"
+#include "sonne/hash.hpp"
+#include "sonne/ignore.hpp"
 
 using namespace Sonne;
 
+void Language::Compile()
+{
+    automaton = std::make_shared<LanguageAutomaton>(*this);
+
+    // every field ends with a null so that moving text from one field to the next still changes the hash
+    hash = HashBytes(name.c_str(), name.size() + 1);
+    hash = HashBytes(lineComment.c_str(), lineComment.size() + 1, hash);
+    hash = HashBytes(blockCommentBegin.c_str(), blockCommentBegin.size() + 1, hash);
+    hash = HashBytes(blockCommentEnd.c_str(), blockCommentEnd.size() + 1, hash);
+
+    for (auto& delimiter : stringDelimiters)
+    {
+        hash = HashBytes(delimiter.c_str(), delimiter.size() + 1, hash);
+    }
+}
+
 void Config::Parse(const std::string& path)
 {
     nlohmann::json configJSON;
@@ -59,6 +78,8 @@ void Config::Parse(const std::string& path)
                 }
             }
 
+            language->Compile();
+
             nlohmann::json extensions = languageNode["extensions"];
 
             for (auto& node : extensions)
@@ -82,6 +103,8 @@ void Config::Parse(const std::string& path)
 
             m_ignored[ignoreStr] = true;
         }
+
+        _CompileIgnored();
     }
 
     if (configJSON.contains("ignoreHidden"))
@@ -89,6 +112,26 @@ void Config::Parse(const std::string& path)
         m_ignoreHidden = configJSON["ignoreHidden"].get<bool>();
     }
 
+    if (configJSON.contains("gitIgnore"))
+    {
+        m_gitIgnore = configJSON["gitIgnore"].get<bool>();
+    }
+
+    if (configJSON.contains("followSymlinks"))
+    {
+        m_followSymlinks = configJSON["followSymlinks"].get<bool>();
+    }
+
+    if (configJSON.contains("dedupe"))
+    {
+        m_dedupe = configJSON["dedupe"].get<bool>();
+    }
+
+    if (configJSON.contains("gitIndex"))
+    {
+        m_useGitIndex = configJSON["gitIndex"].get<bool>();
+    }
+
     if (configJSON.contains("columns"))
     {
         m_columns = configJSON["columns"].get<size_t>();
@@ -192,4 +235,37 @@ nlohmann::json Config::_ConstructConfigJSON()
     configObject["ignore"] = ignoreArray;
 
     return configObject;
-}
\ No newline at end of file
+}
+
+void Config::_CompileIgnored()
+{
+    if (m_ignored.empty())
+    {
+        m_ignoreMatcher = nullptr;
+
+        return;
+    }
+
+    std::shared_ptr<IgnoreMatcher> matcher = std::make_shared<IgnoreMatcher>();
+
+    // negations go last so that they always win, since the map keeps no order of its own
+    for (size_t pass = 0; pass < 2; pass++)
+    {
+        for (auto& ignore : m_ignored)
+        {
+            if ((ignore.first.compare(0, 1, "!") == 0) != (pass == 1))
+            {
+                continue;
+            }
+
+            std::string rule = ignore.first;
+
+            // ignores have always accepted either slash, while rules only split directories on forward slashes
+            std::replace(rule.begin(), rule.end(), '\\', '/');
+
+            matcher->Add(rule);
+        }
+    }
+
+    m_ignoreMatcher = matcher;
+}
@@ -0,0 +1,153 @@
+#include "sonne/pch.hpp"
+#include "sonne/content_table.hpp"
+
+#include "sonne/counter.hpp"
+
+using namespace Sonne;
+
+constexpr size_t ContentTable::ShardCount;
+
+static const uint64_t Prime1 = 11400714785074694791ull;
+static const uint64_t Prime2 = 14029467366897019727ull;
+static const uint64_t Prime3 = 1609587929392839161ull;
+static const uint64_t Prime4 = 9650029242287828579ull;
+static const uint64_t Prime5 = 2870177450012600261ull;
+
+static inline uint64_t Rotate(uint64_t value, int bits)
+{
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static inline uint64_t Read64(const char* data)
+{
+    uint64_t value;
+
+    std::memcpy(&value, data, sizeof(value));
+
+    return value;
+}
+
+static inline uint32_t Read32(const char* data)
+{
+    uint32_t value;
+
+    std::memcpy(&value, data, sizeof(value));
+
+    return value;
+}
+
+static inline uint64_t Round(uint64_t accumulator, uint64_t input)
+{
+    return Rotate(accumulator + input * Prime2, 31) * Prime1;
+}
+
+static inline uint64_t MergeRound(uint64_t hash, uint64_t accumulator)
+{
+    return (hash ^ Round(0, accumulator)) * Prime1 + Prime4;
+}
+
+uint64_t Sonne::HashContent(const char* data, size_t size, uint64_t seed)
+{
+    const char* end = data + size;
+
+    uint64_t hash;
+
+    // four lanes are mixed independently over every 32 bytes, which keeps the multipliers busy in parallel
+    if (size >= 32)
+    {
+        uint64_t lanes[4] = { seed + Prime1 + Prime2, seed + Prime2, seed, seed - Prime1 };
+
+        for (; data + 32 <= end; data += 32)
+        {
+            lanes[0] = Round(lanes[0], Read64(data));
+            lanes[1] = Round(lanes[1], Read64(data + 8));
+            lanes[2] = Round(lanes[2], Read64(data + 16));
+            lanes[3] = Round(lanes[3], Read64(data + 24));
+        }
+
+        hash = Rotate(lanes[0], 1) + Rotate(lanes[1], 7) + Rotate(lanes[2], 12) + Rotate(lanes[3], 18);
+
+        for (uint64_t lane : lanes)
+        {
+            hash = MergeRound(hash, lane);
+        }
+    }
+    else
+    {
+        hash = seed + Prime5;
+    }
+
+    hash += static_cast<uint64_t>(size);
+
+    for (; data + 8 <= end; data += 8)
+    {
+        hash = Rotate(hash ^ Round(0, Read64(data)), 27) * Prime1 + Prime4;
+    }
+
+    if (data + 4 <= end)
+    {
+        hash = Rotate(hash ^ (static_cast<uint64_t>(Read32(data)) * Prime1), 23) * Prime2 + Prime3;
+
+        data += 4;
+    }
+
+    for (; data < end; data++)
+    {
+        hash = Rotate(hash ^ (static_cast<unsigned char>(*data) * Prime5), 11) * Prime1;
+    }
+
+    hash ^= hash >> 33;
+    hash *= Prime2;
+    hash ^= hash >> 29;
+    hash *= Prime3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+bool ContentTable::Find(uint64_t hash, size_t size, uint64_t countKey, CountInfo& info)
+{
+    Shard& shard = m_shards[hash % ShardCount];
+
+    Lines lines;
+
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto find = shard.counts.find(Key { hash, size, countKey });
+
+        if (find == shard.counts.end())
+        {
+            return false;
+        }
+
+        lines = find->second;
+    }
+
+    info.totalLines   = lines.total;
+    info.emptyLines   = lines.empty;
+    info.codeLines    = lines.code;
+    info.commentLines = lines.comment;
+
+    m_duplicates++;
+    m_bytesSaved += size;
+
+    return true;
+}
+
+void ContentTable::Add(uint64_t hash, size_t size, uint64_t countKey, const CountInfo& info)
+{
+    Lines lines = {
+        static_cast<uint32_t>(info.totalLines),
+        static_cast<uint32_t>(info.emptyLines),
+        static_cast<uint32_t>(info.codeLines),
+        static_cast<uint32_t>(info.commentLines)
+    };
+
+    Shard& shard = m_shards[hash % ShardCount];
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    // two copies counted at the same time both end up here, and they have the same counts either way
+    shard.counts.insert(std::make_pair(Key { hash, size, countKey }, lines));
+}
@@ -0,0 +1,275 @@
+#include "sonne/pch.hpp"
+#include "sonne/count_cache.hpp"
+
+#include "sonne/config.hpp"
+
+using namespace Sonne;
+
+constexpr uint32_t CountCache::Version;
+
+static const char CacheMagic[8] = { 'S', 'O', 'N', 'N', 'E', 'C', 'N', 'T' };
+
+static_assert(sizeof(CacheRecord) == 80, "cache records are stored exactly as laid out");
+
+void CacheUpdate::Add(uint64_t pathHash, uint64_t configHash, const FileStamp& stamp, const CountInfo& info)
+{
+    auto find = std::find(m_languages.begin(), m_languages.end(), info.language);
+
+    uint32_t language = static_cast<uint32_t>(find - m_languages.begin());
+
+    if (find == m_languages.end())
+    {
+        m_languages.push_back(info.language);
+    }
+
+    CacheRecord record;
+
+    record.pathHash     = pathHash;
+    record.configHash   = configHash;
+    record.fileSize     = stamp.fileSize;
+    record.modifiedTime = stamp.modifiedTime;
+    record.inode        = stamp.inode;
+    record.totalLines   = info.totalLines;
+    record.emptyLines   = info.emptyLines;
+    record.codeLines    = info.codeLines;
+    record.commentLines = info.commentLines;
+    record.language     = language;
+    record.flags        = info.linesOnly ? 1 : 0;
+
+    m_records.push_back(record);
+}
+
+bool CountCache::Load(const std::string& path, const std::string& root)
+{
+    m_records     = nullptr;
+    m_recordCount = 0;
+
+    m_languages.clear();
+
+    // always map the file, as only the records that are looked up are ever touched
+    if (!m_view.Open(path, m_buffer, 0))
+    {
+        return false;
+    }
+
+    const char* data = m_view.GetData();
+
+    size_t size = m_view.GetSize();
+
+    if (size < sizeof(Header))
+    {
+        return false;
+    }
+
+    Header header;
+
+    std::memcpy(&header, data, sizeof(Header));
+
+    bool valid = std::memcmp(header.magic, CacheMagic, sizeof(CacheMagic)) == 0 &&
+        header.version == Version &&
+        header.rootHash == HashBytes(root.data(), root.size()) &&
+        header.recordCount <= (size - sizeof(Header)) / sizeof(CacheRecord) &&
+        header.languagesOffset == sizeof(Header) + header.recordCount * sizeof(CacheRecord);
+
+    if (!valid)
+    {
+        return false;
+    }
+
+    // the names are few and short, so they are copied out once rather than read from the mapping every time
+    size_t offset = header.languagesOffset;
+
+    for (uint32_t index = 0; index < header.languageCount; index++)
+    {
+        uint32_t length = 0;
+
+        if (offset + sizeof(length) > size)
+        {
+            return false;
+        }
+
+        std::memcpy(&length, data + offset, sizeof(length));
+
+        offset += sizeof(length);
+
+        if (length > size - offset)
+        {
+            m_languages.clear();
+
+            return false;
+        }
+
+        m_languages.push_back(std::string(data + offset, length));
+
+        offset += length;
+    }
+
+    m_records     = reinterpret_cast<const CacheRecord*>(data + sizeof(Header));
+    m_recordCount = static_cast<size_t>(header.recordCount);
+
+    return true;
+}
+
+void CountCache::Close()
+{
+    m_view.Close();
+
+    m_records     = nullptr;
+    m_recordCount = 0;
+
+    m_languages.clear();
+}
+
+bool CountCache::Find(uint64_t pathHash, uint64_t configHash, const FileStamp& stamp, CountInfo& info) const
+{
+    const CacheRecord* end = m_records + m_recordCount;
+
+    const CacheRecord* record = std::lower_bound(m_records, end, pathHash, [](const CacheRecord& left, uint64_t hash) {
+        return left.pathHash < hash;
+    });
+
+    // two paths can share a hash, which is fine as the rest of the record has to match as well
+    for (; record != end && record->pathHash == pathHash; record++)
+    {
+        bool matches = record->configHash == configHash &&
+            record->fileSize == stamp.fileSize &&
+            record->modifiedTime == stamp.modifiedTime &&
+            record->inode == stamp.inode &&
+            record->language < m_languages.size();
+
+        if (!matches)
+        {
+            continue;
+        }
+
+        info = CountInfo(
+            m_languages[record->language],
+            1,
+            static_cast<size_t>(record->totalLines),
+            static_cast<size_t>(record->emptyLines),
+            static_cast<size_t>(record->codeLines),
+            static_cast<size_t>(record->commentLines));
+
+        info.linesOnly = (record->flags & 1) != 0;
+
+        return true;
+    }
+
+    return false;
+}
+
+uint64_t CountCache::GetConfigHash(const Config& config, const std::string& path)
+{
+    std::string extension = Counter::GetExtension(path);
+
+    uint64_t hash = HashBytes(reinterpret_cast<const char*>(&Version), sizeof(Version));
+
+    if (config.HasLanguage(extension))
+    {
+        hash ^= config.GetLanguage(extension)->hash;
+    }
+
+    return config.GetLinesOnly() ? ~hash : hash;
+}
+
+bool CountCache::Write(
+    const std::string& path,
+    const std::string& root,
+    const std::vector<CacheUpdate>& updates,
+    int64_t startTime)
+{
+    std::vector<std::string> languages;
+
+    std::vector<CacheRecord> records;
+
+    for (const CacheUpdate& update : updates)
+    {
+        // each worker numbered its languages on its own, so map them onto one shared table
+        std::vector<uint32_t> remap;
+
+        for (const std::string& language : update.m_languages)
+        {
+            auto find = std::find(languages.begin(), languages.end(), language);
+
+            remap.push_back(static_cast<uint32_t>(find - languages.begin()));
+
+            if (find == languages.end())
+            {
+                languages.push_back(language);
+            }
+        }
+
+        for (const CacheRecord& record : update.m_records)
+        {
+            if (record.modifiedTime > startTime - 1000000000LL)
+            {
+                continue;
+            }
+
+            records.push_back(record);
+
+            records.back().language = remap[record.language];
+        }
+    }
+
+    std::sort(records.begin(), records.end(), [](const CacheRecord& left, const CacheRecord& right) {
+        return left.pathHash < right.pathHash;
+    });
+
+    Header header;
+
+    std::memset(&header, 0, sizeof(Header));
+    std::memcpy(header.magic, CacheMagic, sizeof(CacheMagic));
+
+    header.version         = Version;
+    header.languageCount   = static_cast<uint32_t>(languages.size());
+    header.recordCount     = records.size();
+    header.rootHash        = HashBytes(root.data(), root.size());
+    header.languagesOffset = sizeof(Header) + records.size() * sizeof(CacheRecord);
+
+    // a run reading the old cache keeps its own mapping of it, and sees the new file whole once it is renamed
+    auto unique = std::chrono::steady_clock::now().time_since_epoch().count();
+
+    std::string temporaryPath = fmt::format("{}.{}.tmp", path, unique);
+
+    {
+        std::ofstream out(temporaryPath, std::ios::binary | std::ios::trunc);
+
+        out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+
+        if (!records.empty())
+        {
+            out.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(CacheRecord));
+        }
+
+        for (const std::string& language : languages)
+        {
+            uint32_t length = static_cast<uint32_t>(language.size());
+
+            out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+            out.write(language.data(), language.size());
+        }
+
+        out.close();
+
+        if (!out.good())
+        {
+            std::remove(temporaryPath.c_str());
+
+            return false;
+        }
+    }
+
+#ifdef _WIN32
+    bool renamed = MoveFileEx(temporaryPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+    bool renamed = std::rename(temporaryPath.c_str(), path.c_str()) == 0;
+#endif
+
+    if (!renamed)
+    {
+        std::remove(temporaryPath.c_str());
+    }
+
+    return renamed;
+}
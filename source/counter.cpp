@@ -3,20 +3,96 @@
 
 #include "sonne/file.hpp"
 #include "sonne/config.hpp"
+#include "sonne/automaton.hpp"
+#include "sonne/content_table.hpp"
+#include "sonne/thread_pool.hpp"
 
 using namespace Sonne;
 
-Counter::Counter(const std::string& path)
+namespace Sonne
+{
+
+    /**
+     The counts for one segment of a file when entering that segment in a specific state.
+     */
+    struct SegmentResult
+    {
+
+        CountInfo info = CountInfo("", 0, 0, 0, 0, 0);
+
+        CountState exitState = CountState::NORMAL;
+
+    };
+
+    /**
+     Shared state for counting the segments of one file across several workers.
+
+     Held by a shared pointer as helper tasks can start after the count has finished, in which case they find no units
+     left to claim and return right away.
+     */
+    struct SegmentJob
+    {
+
+        // offsets in the file where each segment begins, with the file size as the last entry
+        std::vector<size_t> bounds;
+
+        // the states a segment could be entered in, each segment is counted once per state
+        std::vector<CountState> states;
+
+        // results for each unit, indexed by segment * states + state
+        std::vector<SegmentResult> results;
+
+        // a read buffer for each helper task, the thread that started the job uses its own
+        std::vector<ReadBuffer> buffers;
+
+        std::atomic<size_t> nextUnit;
+
+        size_t finishedUnits = 0;
+
+        std::mutex mutex;
+
+        std::condition_variable finished;
+
+        SegmentJob() : nextUnit(0)
+        {
+        }
+
+        inline size_t GetUnitCount() const
+        {
+            return (bounds.size() - 1) * states.size();
+        }
+
+    };
+
+}
+
+Counter::Counter(std::string path)
     :
-    m_path(path)
+    m_ownedPath(std::move(path)),
+    m_path(m_ownedPath)
 {
 }
 
-CountInfo Counter::Count(std::shared_ptr<Config> config)
+Counter::Counter(const std::string& path, size_t fileSize, int directory, size_t nameOffset, bool exactSize)
+    :
+    m_path(path),
+    m_hasMetadata(true),
+    m_fileSize(fileSize),
+    m_directory(directory),
+    m_nameOffset(nameOffset),
+    m_exactSize(exactSize)
+{
+}
+
+CountInfo Counter::Count(
+    const std::shared_ptr<Config>& config,
+    ThreadPool* pool,
+    ReadBuffer* buffer,
+    ContentTable* contents)
 {
     CountInfo info = {};
 
-    std::string ext = _GetExtension(m_path);
+    std::string ext = GetExtension(m_path);
 
     std::shared_ptr<Language> language = nullptr;
 
@@ -30,36 +106,115 @@ CountInfo Counter::Count(std::shared_ptr<Config> config)
         info.language = language->name;
     }
 
-    Entry file = GetFSEntry(m_path);
+    // the file is still classified by its language, but counted like plain text so no tokens are ever checked
+    if (config->GetLinesOnly())
+    {
+        info.linesOnly = true;
+
+        language = nullptr;
+    }
+
+    size_t fileSize = m_fileSize;
 
-    if (!file.isValid || file.isDirectory)
+    if (!m_hasMetadata)
     {
-        Fatal(fmt::format("Invalid file passed to counter! Path: {}\n", m_path));
+        Entry file = GetFSEntry(m_path);
+
+        if (!file.isValid || file.isDirectory)
+        {
+            Fatal(fmt::format("Invalid file passed to counter! Path: {}\n", m_path));
+        }
+
+        fileSize = file.fileSize;
     }
 
-    std::ifstream in(m_path);
+    // borrow the read buffer of the worker if there is one, otherwise fall back to one for just this count
+    ReadBuffer localBuffer;
 
-    if (!in.good())
+    ReadBuffer& readBuffer = (buffer != nullptr) ? *buffer : localBuffer;
+
+    bool parallel = (pool != nullptr && pool->GetSize() > 1 && fileSize >= config->GetParallelThreshold());
+
+    // very large files are streamed through in chunks so that memory use stays bounded
+    if (parallel || fileSize >= config->GetStreamThreshold())
+    {
+        FileStream stream;
+
+        if (!stream.Open(_GetOpenPath(), m_directory))
+        {
+            if (!m_exactSize)
+            {
+                info.files = 0; // removed since the size was taken, so there is nothing left to count
+
+                return info;
+            }
+
+            Fatal(fmt::format("Failed to open file at path: '{}'", m_path));
+        }
+
+        if (parallel)
+        {
+            _CountInParallel(stream, language, info, *pool, config, readBuffer);
+        }
+        else
+        {
+            _CountFromStream(stream, language, info, readBuffer, config->GetChunkSize());
+        }
+
+        return info;
+    }
+
+    FileView view;
+
+    bool opened = m_hasMetadata
+        ? view.Open(_GetOpenPath(), fileSize, readBuffer, FileView::DefaultMapThreshold, m_directory, m_exactSize)
+        : view.Open(m_path, readBuffer);
+
+    if (!opened)
     {
+        if (!m_exactSize)
+        {
+            info.files = 0;
+
+            return info;
+        }
+
         Fatal(fmt::format("Failed to open file at path: '{}'", m_path));
     }
 
-    in.seekg(0, std::ios::end); // seek to the end of the buffer to grab size
+    if (contents == nullptr)
+    {
+        _CountFromBuffer(view.GetData(), view.GetSize(), language, info);
 
-    size_t bufferSize = static_cast<size_t>(in.tellg());
+        return info;
+    }
 
-    std::vector<char> buffer(bufferSize);
-    
-    in.seekg(0); // go back to beginning of buffer
+    // the same bytes count differently as another language or when only counting lines
+    uint64_t countKey = (language != nullptr) ? language->hash : 0;
 
-    in.read(buffer.data(), bufferSize);
+    if (info.linesOnly)
+    {
+        countKey = ~countKey;
+    }
 
-    _CountFromBuffer(buffer, language, info);
+    uint64_t hash = HashContent(view.GetData(), view.GetSize());
+
+    if (!contents->Find(hash, view.GetSize(), countKey, info))
+    {
+        _CountFromBuffer(view.GetData(), view.GetSize(), language, info);
+
+        contents->Add(hash, view.GetSize(), countKey, info);
+    }
 
     return info;
 }
 
-std::string Counter::_GetExtension(const std::string& path)
+const char* Counter::_GetOpenPath() const
+{
+    return (m_directory >= 0) ? (m_path.c_str() + m_nameOffset) : m_path.c_str();
+}
+
+std::string Counter::GetExtension(const std::string& path)
 {
     auto lastPeriod = path.find_last_of('.');
 
@@ -69,13 +224,62 @@ std::string Counter::_GetExtension(const std::string& path)
     return "";
 }
 
-char Counter::_GetBufferLookahead(std::vector<char>& buffer, const size_t& index)
+std::shared_ptr<const LanguageAutomaton> Counter::_GetAutomaton(std::shared_ptr<Language> language)
+{
+    // plain text has no tokens, so it only ever stops on newlines
+    static const std::shared_ptr<const LanguageAutomaton> plainText = std::make_shared<LanguageAutomaton>(Language());
+
+    if (language == nullptr)
+    {
+        return plainText;
+    }
+
+    // languages are compiled when added to a config, this only covers ones that were built by hand
+    if (language->automaton == nullptr)
+    {
+        return std::make_shared<LanguageAutomaton>(*language);
+    }
+
+    return language->automaton;
+}
+
+void Counter::_CountFromBuffer(
+    const char* buffer,
+    size_t size,
+    std::shared_ptr<Language> language,
+    CountInfo& info)
 {
-    return ((index < buffer.size()) ? buffer.at(index) : '\0');
+    CountData data(
+        0, // lineLength
+        0, // lineLengthWithoutWhitespace
+        0, // index
+        CountState::NORMAL, // state
+        true, // shouldCountBlockLine
+        false, // wasBlockComment
+        language,
+        info,
+        buffer,
+        size
+    );
+
+    std::shared_ptr<const LanguageAutomaton> automaton = _GetAutomaton(language);
+
+    data.automaton = automaton.get();
+
+    _CountRange(data, 0, size);
+
+    _FinishCount(data);
 }
 
-void Counter::_CountFromBuffer(std::vector<char>& buffer, std::shared_ptr<Language> language, CountInfo& info)
+void Counter::_CountFromStream(
+    FileStream& stream,
+    std::shared_ptr<Language> language,
+    CountInfo& info,
+    ReadBuffer& buffer,
+    size_t chunkSize)
 {
+    std::shared_ptr<const LanguageAutomaton> automaton = _GetAutomaton(language);
+
     CountData data(
         0, // lineLength
         0, // lineLengthWithoutWhitespace
@@ -85,14 +289,300 @@ void Counter::_CountFromBuffer(std::vector<char>& buffer, std::shared_ptr<Langua
         false, // wasBlockComment
         language,
         info,
-        buffer
+        nullptr,
+        0
+    );
+
+    data.automaton = automaton.get();
+
+    _CountStreamRange(data, stream, 0, stream.GetSize(), buffer, chunkSize);
+
+    _FinishCount(data);
+}
+
+void Counter::_CountStreamRange(
+    CountData& data,
+    FileStream& stream,
+    size_t begin,
+    size_t end,
+    ReadBuffer& buffer,
+    size_t chunkSize)
+{
+    // hold back enough bytes at the end of each chunk for a token that straddles the boundary to still be matched
+    size_t carry = std::max<size_t>(data.automaton->GetMaxTokenLength(), 1) - 1;
+
+    chunkSize = std::max(chunkSize, carry + 1);
+
+    char* window = buffer.Reserve(chunkSize);
+
+    data.buffer = window;
+
+    size_t offset = begin; // offset in the file of the start of the window
+    size_t filled = 0; // bytes in the window, including those carried over from the last chunk
+
+    while (offset < end)
+    {
+        size_t read = 0;
+
+        if (!stream.ReadAt(window + filled, chunkSize - filled, offset + filled, read))
+        {
+            Fatal(fmt::format("Failed to read file at path: '{}'", m_path));
+        }
+
+        filled += read;
+
+        bool atEnd = (filled < chunkSize); // reads only come up short at the end of the file
+
+        // everything after the end of this chunk is only there for lookahead, so it is counted with the next chunk
+        size_t chunkEnd = std::min(offset + (atEnd ? filled : (filled - carry)), end);
+
+        data.size = filled;
+
+        _CountRange(data, 0, chunkEnd - offset);
+
+        if (atEnd || chunkEnd == end)
+        {
+            break;
+        }
+
+        std::memmove(window, window + (chunkEnd - offset), filled - (chunkEnd - offset));
+
+        filled -= chunkEnd - offset;
+        offset  = chunkEnd;
+    }
+}
+
+std::vector<size_t> Counter::_FindSegmentBounds(FileStream& stream, size_t segments)
+{
+    size_t fileSize = stream.GetSize();
+
+    std::vector<size_t> bounds = { 0 };
+
+    char probe[4096];
+
+    for (size_t segment = 1; segment < segments; segment++)
+    {
+        // start looking for a newline at an even split, but never before the last segment start
+        size_t offset = std::max((fileSize / segments) * segment, bounds.back());
+
+        size_t bound = fileSize;
+
+        while (offset < fileSize)
+        {
+            size_t read = 0;
+
+            if (!stream.ReadAt(probe, sizeof(probe), offset, read) || read == 0)
+            {
+                break;
+            }
+
+            const char* newline = static_cast<const char*>(std::memchr(probe, '\n', read));
+
+            if (newline != nullptr)
+            {
+                bound = offset + static_cast<size_t>(newline - probe) + 1; // segments begin right after a newline
+
+                break;
+            }
+
+            offset += read;
+        }
+
+        if (bound >= fileSize)
+        {
+            break; // no more newlines, so the rest of the file has to be one segment
+        }
+
+        if (bound > bounds.back())
+        {
+            bounds.push_back(bound);
+        }
+    }
+
+    bounds.push_back(fileSize);
+
+    return bounds;
+}
+
+void Counter::_CountSegmentUnit(
+    SegmentJob& job,
+    size_t unit,
+    FileStream& stream,
+    std::shared_ptr<Language> language,
+    std::shared_ptr<const LanguageAutomaton> automaton,
+    ReadBuffer& buffer,
+    size_t chunkSize)
+{
+    size_t segment = unit / job.states.size();
+
+    CountState entry = job.states.at(unit % job.states.size());
+
+    SegmentResult& result = job.results.at(unit);
+
+    // the first segment is only ever entered at the start of the file
+    if (segment == 0 && entry != CountState::NORMAL)
+    {
+        return;
+    }
+
+    // every other flag is reset by the newline before a segment, so the state is all that has to be guessed
+    CountData data(
+        0, // lineLength
+        0, // lineLengthWithoutWhitespace
+        0, // index
+        entry, // state
+        true, // shouldCountBlockLine
+        false, // wasBlockComment
+        language,
+        result.info,
+        nullptr,
+        0
     );
 
-    for (size_t index = 0; index < buffer.size(); index++)
+    data.automaton = automaton.get();
+
+    _CountStreamRange(data, stream, job.bounds[segment], job.bounds[segment + 1], buffer, chunkSize);
+
+    if (segment + 2 == job.bounds.size())
+    {
+        _FinishCount(data); // only the last segment holds the last line of the file
+    }
+
+    result.exitState = data.state;
+}
+
+void Counter::_CountInParallel(
+    FileStream& stream,
+    std::shared_ptr<Language> language,
+    CountInfo& info,
+    ThreadPool& pool,
+    std::shared_ptr<Config> config,
+    ReadBuffer& buffer)
+{
+    std::shared_ptr<const LanguageAutomaton> automaton = _GetAutomaton(language);
+
+    size_t fileSize    = stream.GetSize();
+    size_t segmentSize = std::max<size_t>(config->GetSegmentSize(), 1);
+    size_t chunkSize   = config->GetChunkSize();
+
+    size_t segments = std::min((fileSize + segmentSize - 1) / segmentSize, pool.GetSize() * 4);
+
+    std::shared_ptr<SegmentJob> job = std::make_shared<SegmentJob>();
+
+    job->bounds = _FindSegmentBounds(stream, std::max<size_t>(segments, 1));
+
+    // a segment can only be entered in a state that the language is able to reach
+    job->states.push_back(CountState::NORMAL);
+
+    if (automaton->HasKind(TOKEN_STRING_DELIMITER))
+    {
+        job->states.push_back(CountState::STRING);
+    }
+
+    if (automaton->HasKind(TOKEN_BLOCK_COMMENT_BEGIN))
+    {
+        job->states.push_back(CountState::BLOCK_COMMENT);
+    }
+
+    job->results.resize(job->GetUnitCount());
+
+    size_t units = job->GetUnitCount();
+
+    size_t helpers = std::min(pool.GetSize(), units) - 1;
+
+    job->buffers.resize(helpers);
+
+    // claims units until none are left, any thread that runs this only waits on units that are actively running
+    auto work = [this, job, units, &stream, language, automaton, chunkSize](ReadBuffer& buffer) {
+        while (true)
+        {
+            size_t unit = job->nextUnit++;
+
+            if (unit >= units)
+            {
+                return;
+            }
+
+            _CountSegmentUnit(*job, unit, stream, language, automaton, buffer, chunkSize);
+
+            std::lock_guard<std::mutex> lock(job->mutex);
+
+            job->finishedUnits++;
+
+            if (job->finishedUnits == units)
+            {
+                job->finished.notify_all();
+            }
+        }
+    };
+
+    for (size_t index = 0; index < helpers; index++)
+    {
+        pool.Submit([work, job, index](size_t) { work(job->buffers[index]); });
+    }
+
+    work(buffer); // the calling thread counts alongside the helpers rather than blocking a worker
+
+    {
+        std::unique_lock<std::mutex> lock(job->mutex);
+
+        job->finished.wait(lock, [&job, units]() { return job->finishedUnits == units; });
+    }
+
+    // stitch the segments together by following the exit state of each segment into the next one
+    CountState state = CountState::NORMAL;
+
+    for (size_t segment = 0; segment + 1 < job->bounds.size(); segment++)
+    {
+        size_t stateIndex = static_cast<size_t>(
+            std::find(job->states.begin(), job->states.end(), state) - job->states.begin());
+
+        SegmentResult& result = job->results.at(segment * job->states.size() + stateIndex);
+
+        info += result.info;
+
+        state = result.exitState;
+    }
+}
+
+void Counter::_CountRange(CountData& data, size_t begin, size_t end)
+{
+    if (data.language == nullptr)
+    {
+        _CountLines(data, begin, end);
+
+        return;
+    }
+
+    const char* buffer = data.buffer;
+
+    CountInfo& info = data.info;
+
+    for (size_t index = begin; index < end; index++)
     {
+        // bytes that can change the current state, everything else is skipped over by the scan kernel
+        const ScanSet& stateStops = data.automaton->GetStops(data.state);
+
+        if (!stateStops.overflowed)
+        {
+            size_t nonBlank = 0;
+
+            size_t stop = ScanToStop(buffer, index, end, stateStops, nonBlank);
+
+            data.lineLength += stop - index;
+            data.lineLengthWithoutWhitespace += nonBlank;
+
+            index = stop;
+
+            if (index == end)
+            {
+                break;
+            }
+        }
+
         data.index = index;
 
-        char current = buffer.at(index); // grab the current character
+        char current = buffer[index]; // grab the current character
 
         // skip past carriage return
         if (current == '\r')
@@ -132,15 +622,60 @@ void Counter::_CountFromBuffer(std::vector<char>& buffer, std::shared_ptr<Langua
             continue;
         }
     }
+}
+
+void Counter::_CountLines(CountData& data, size_t begin, size_t end)
+{
+    // without a language this is the plain text automaton, which only stops on newlines and carriage returns
+    const ScanSet& lineStops = data.automaton->GetStops(CountState::NORMAL);
+
+    const char* buffer = data.buffer;
+
+    CountInfo& info = data.info;
 
+    size_t nonBlank = data.lineLengthWithoutWhitespace;
+
+    size_t index = begin;
+
+    while (index < end)
+    {
+        size_t stop = ScanToStop(buffer, index, end, lineStops, nonBlank);
+
+        if (stop == end)
+        {
+            break;
+        }
+
+        // carriage returns are skipped over, so only newlines end a line
+        if (buffer[stop] == '\n')
+        {
+            info.totalLines++;
+
+            if (nonBlank == 0)
+            {
+                info.emptyLines++;
+            }
+
+            nonBlank = 0;
+        }
+
+        index = stop + 1;
+    }
+
+    // line lengths are only kept for whether the line is empty, which is all the last line needs
+    data.lineLengthWithoutWhitespace = nonBlank;
+}
+
+void Counter::_FinishCount(CountData& data)
+{
     // interpret the last line of the file as there's no \n to piggyback on
-    info.totalLines++;
+    data.info.totalLines++;
 
     _LanguageNewLineCheck(data);
 
     if (data.lineLengthWithoutWhitespace == 0)
     {
-        info.emptyLines++; // increment the empty lines for the last line as it has no \n char
+        data.info.emptyLines++; // increment the empty lines for the last line as it has no \n char
     }
 }
 
@@ -205,45 +740,6 @@ void Counter::_LanguageNewLineCheck(CountData& data)
     }
 }
 
-bool Counter::_CompareStringToBuffer(std::vector<char>& buffer, std::string& compare, const size_t& start)
-{
-    // check if the first character matches, and if not we can already say that the string doesn't match
-    if (buffer[start] != compare[0])
-    {
-        return false;
-    }
-
-    for (size_t i = 1; i < compare.size(); i++)
-    {
-        char& compareChar = compare.at(i);
-
-        if (_GetBufferLookahead(buffer, start + i) != compareChar)
-        {
-            return false; // the current character is not the same of that in the buffer, so no match
-        }
-    }
-
-    return true;
-}
-
-bool Counter::_CheckStringDelimiter(
-    std::vector<char>& buffer,
-    std::vector<std::string>& delimiters,
-    const size_t& start)
-{
-    for (auto& delimiter : delimiters) // check all string delimiters for a string begin
-    {
-        bool hasDelimiter = _CompareStringToBuffer(buffer, delimiter, start);
-
-        if (hasDelimiter)
-        {
-            return true;
-        }
-    }
-
-    return false;
-}
-
 bool Counter::_LanguageCommentStringChecks(CountData& data)
 {
     if (data.language == nullptr)
@@ -257,83 +753,68 @@ bool Counter::_LanguageCommentStringChecks(CountData& data)
         return true;
     }
 
+    // find every token that begins here in one walk of the automaton, then resolve them by priority below
+    uint8_t matched = data.automaton->Match(
+        data.buffer,
+        data.index,
+        data.size,
+        LanguageAutomaton::GetKindsForState(data.state));
+
+    if (matched == 0)
+    {
+        return false;
+    }
+
     if (data.state == CountState::NORMAL)
     {
-        if (!(data.language)->stringDelimiters.empty()) // check if we are about to begin a string
+        // check if we are about to begin a string
+        if (matched & TOKEN_STRING_DELIMITER)
         {
-            bool hasDelimiter = _CheckStringDelimiter(data.buffer, data.language->stringDelimiters, data.index);
+            data.state = CountState::STRING;
 
-            if (hasDelimiter)
-            {
-                data.state = CountState::STRING;
-                
-                return true; // skip over the delimiter for this string
-            }
+            return true; // skip over the delimiter for this string
         }
 
         // look for block comments before line comments, for languages like lua that have the same beginning for both
-        if (!data.language->blockCommentBegin.empty())
+        if (matched & TOKEN_BLOCK_COMMENT_BEGIN)
         {
-            bool hasBlockCommentBeginning = _CompareStringToBuffer(
-                data.buffer,
-                data.language->blockCommentBegin,
-                data.index);
-
-            if (hasBlockCommentBeginning)
-            {
-                // only count the first line of a block comment if it is at the start of the line excluding whitespace
-                data.shouldCountBlockLine = (data.lineLengthWithoutWhitespace == 0);
+            // only count the first line of a block comment if it is at the start of the line excluding whitespace
+            data.shouldCountBlockLine = (data.lineLengthWithoutWhitespace == 0);
 
-                data.state = CountState::BLOCK_COMMENT;
+            data.state = CountState::BLOCK_COMMENT;
 
-                return true; // skip the rest of this characters processing
-            }
+            return true; // skip the rest of this characters processing
         }
 
         // check for a line comment but only set it to count if it is at the beginning of the line
         //
         // this is to prevent parsing bugs regarding line comments still parsing characters as code
-        if (!data.language->lineComment.empty())
+        if (matched & TOKEN_LINE_COMMENT)
         {
-            bool hasLineComment = _CompareStringToBuffer(data.buffer, data.language->lineComment, data.index);
-
-            if (hasLineComment)
-            {
-                data.state = CountState::LINE_COMMENT;
+            data.state = CountState::LINE_COMMENT;
 
-                data.countLineComment = (data.lineLengthWithoutWhitespace == 0); // only count if it begins a line
+            data.countLineComment = (data.lineLengthWithoutWhitespace == 0); // only count if it begins a line
 
-                return true; // skip over this character as we know we are in a line comment
-            }
+            return true; // skip over this character as we know we are in a line comment
         }
     }
 
     // check if we are at the end of a string and if so move to normal counting
-    if (data.state == CountState::STRING && !data.language->stringDelimiters.empty())
+    if (data.state == CountState::STRING && (matched & TOKEN_STRING_DELIMITER))
     {
-        bool hasDelimiter = _CheckStringDelimiter(data.buffer, data.language->stringDelimiters, data.index);
+        data.state = CountState::NORMAL;
 
-        if (hasDelimiter)
-        {
-            data.state = CountState::NORMAL;
-
-            return true; // skip over the ending delimiter for this string
-        }
+        return true; // skip over the ending delimiter for this string
     }
 
-    // if we have endings for block comments, check if we are at a block ender if currently counting a block comment
-    if (data.state == CountState::BLOCK_COMMENT && !data.language->blockCommentEnd.empty())
+    // check if we are at a block ender if currently counting a block comment
+    if (data.state == CountState::BLOCK_COMMENT && (matched & TOKEN_BLOCK_COMMENT_END))
     {
-        bool hasBlockCommentEnding = _CompareStringToBuffer(data.buffer, data.language->blockCommentEnd, data.index);
+        data.state = CountState::NORMAL;
 
-        if (hasBlockCommentEnding)
-        {
-            data.state = CountState::NORMAL;
+        data.wasBlockComment = true;
 
-            data.wasBlockComment = true;
-            
-            return true; // skip this character as we know it ends a block comment
-        }
+        return true; // skip this character as we know it ends a block comment
     }
 
     return false;
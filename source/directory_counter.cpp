@@ -2,10 +2,254 @@
 #include "sonne/directory_counter.hpp"
 
 #include "sonne/file.hpp"
+#include "sonne/file_tree.hpp"
+#include "sonne/git_index.hpp"
+#include "sonne/identity_set.hpp"
 #include "sonne/config.hpp"
+#include "sonne/content_table.hpp"
+#include "sonne/ignore.hpp"
+#include "sonne/thread_pool.hpp"
 
 using namespace Sonne;
 
+/**
+ Look up the size of a file that came from a list, returning false if it is missing or is not a regular file.
+ */
+static bool FindListedFile(const std::string& path, size_t& fileSize)
+{
+#ifdef _WIN32
+    Entry entry = GetFSEntry(path);
+
+    if (!entry.isValid || entry.isDirectory)
+    {
+        return false;
+    }
+
+    fileSize = entry.fileSize;
+#else
+    struct stat statBuffer;
+
+    if (stat(path.c_str(), &statBuffer) != 0 || !S_ISREG(statBuffer.st_mode))
+    {
+        return false;
+    }
+
+    fileSize = static_cast<size_t>(statBuffer.st_size);
+#endif
+
+    return true;
+}
+
+namespace Sonne
+{
+
+    /**
+     A directory waiting to be read, along with the config and ignore rules that apply to its parent.
+     */
+    struct QueuedDirectory
+    {
+
+        uint32_t node;
+
+        std::shared_ptr<Config> config;
+
+        std::shared_ptr<const IgnoreScope> ignores;
+
+    };
+
+    /**
+     A file held back until the walk is over, as no language was known for it when it was found.
+     */
+    struct HeldFile
+    {
+
+        uint32_t node;
+
+        FileStamp stamp;
+
+    };
+
+    /**
+     Everything shared between the tasks of a single directory walk and the thread that started it.
+     */
+    struct WalkJob
+    {
+
+        ThreadPool& pool;
+
+        // every file and directory that the walk has kept, which everything else refers to by index
+        FileTree tree;
+
+        std::deque<QueuedDirectory> directories;
+
+        // the amount of directories that are being read by a worker right now
+        size_t activeWalkers = 0;
+
+        std::mutex mutex;
+
+        // signaled when a directory is queued or a worker finishes reading one
+        std::condition_variable changed;
+
+        // held while merging the languages of a config that was found into the config for the whole walk
+        std::mutex configMutex;
+
+        std::atomic<size_t> configs;
+        std::atomic<size_t> ignored;
+
+        // the root directory held open for the whole walk, which everything below it is opened relative to
+        int root = -1;
+
+        size_t rootLength = 0; // where the path relative to the root starts in a full path
+
+        // the global excludes of git, which apply from the top of every repository found in the walk
+        IgnoreMatcher globalIgnores;
+
+        // file sizes from a git index may be stale, so they are checked when each file is opened
+        bool exactSizes = true;
+
+        // when following links, everything already walked is kept here so nothing is walked or counted twice
+        bool followLinks = false;
+
+        IdentitySet identities;
+
+        std::atomic<size_t> duplicates;
+
+        // counts from the last run, or nullptr when nothing is cached
+        CountCache* cache = nullptr;
+
+        // counts of every file read so far by its contents, or nullptr when identical files are not looked for
+        ContentTable* contents = nullptr;
+
+        size_t pathStart = 0; // where the path relative to the root starts, which is what the cache is keyed by
+
+        // handed every file once it is counted, or nullptr when nothing wants to know about single files
+        const DirectoryCounter::FileVisitor* fileVisitor = nullptr;
+
+        // everything below is indexed by worker, so only the worker that owns an entry ever touches it
+        std::vector<std::shared_ptr<CountBatch>> batches;
+
+        std::vector<std::vector<HeldFile>> unclassified;
+
+        std::vector<DirectoryInfo> totals;
+
+        std::vector<ReadBuffer> buffers;
+
+        // the path of the file being counted, rebuilt from the tree into the same string each time
+        std::vector<std::string> paths;
+
+        std::vector<DirectoryReader> readers;
+
+        // the counts made by each worker, to be written as the next cache
+        std::vector<CacheUpdate> updates;
+
+        std::vector<size_t> cacheHits;
+
+        WalkJob(ThreadPool& pool)
+            :
+            pool(pool),
+            configs(0),
+            ignored(0),
+            duplicates(0),
+            batches(pool.GetSize()),
+            unclassified(pool.GetSize()),
+            totals(pool.GetSize()),
+            buffers(pool.GetSize()),
+            paths(pool.GetSize()),
+            readers(pool.GetSize()),
+            updates(pool.GetSize()),
+            cacheHits(pool.GetSize(), 0)
+        {
+        }
+
+        /**
+         Count every file in a batch on the worker passed in, adding to the totals of that worker.
+         */
+        inline void Count(CountBatch& batch, size_t worker)
+        {
+            bool listed = !batch.paths.empty();
+
+            size_t count = listed ? batch.paths.size() : batch.files.size();
+
+            for (size_t index = 0; index < count; index++)
+            {
+                std::string& path = paths[worker];
+
+                size_t fileSize = 0;
+
+                if (listed)
+                {
+                    path = batch.paths[index];
+
+                    if (!FindListedFile(path, fileSize))
+                    {
+                        continue;
+                    }
+                }
+                else
+                {
+                    tree.GetPath(batch.files[index], path);
+
+                    fileSize = tree.GetFileSize(batch.files[index]);
+                }
+
+                // a file the walk could not stamp, such as one from a git index, is never cached
+                bool cached = (cache != nullptr && index < batch.stamps.size());
+
+                cached = cached && batch.stamps[index].modifiedTime != 0;
+
+                uint64_t pathHash   = 0;
+                uint64_t configHash = 0;
+
+                if (cached)
+                {
+                    pathHash   = HashBytes(path.c_str() + pathStart, path.size() - pathStart);
+                    configHash = CountCache::GetConfigHash(*batch.config, path);
+
+                    CountInfo found;
+
+                    if (cache->Find(pathHash, configHash, batch.stamps[index], found))
+                    {
+                        totals[worker].Add(found);
+
+                        updates[worker].Add(pathHash, configHash, batch.stamps[index], found);
+
+                        cacheHits[worker]++;
+
+                        if (fileVisitor != nullptr)
+                        {
+                            (*fileVisitor)(path, found);
+                        }
+
+                        continue;
+                    }
+                }
+
+                // the size of the file is already known, so the counter can skip looking it up again
+                Counter counter(path, fileSize, root, rootLength, exactSizes);
+
+                CountInfo counted = counter.Count(batch.config, &pool, &buffers[worker], contents);
+
+                if (counted.files > 0)
+                {
+                    totals[worker].Add(counted);
+
+                    if (cached)
+                    {
+                        updates[worker].Add(pathHash, configHash, batch.stamps[index], counted);
+                    }
+
+                    if (fileVisitor != nullptr)
+                    {
+                        (*fileVisitor)(path, counted);
+                    }
+                }
+            }
+        }
+
+    };
+
+}
+
 DirectoryCounter::DirectoryCounter(const std::string& path, std::shared_ptr<Config> config)
     :
     m_path(path),
@@ -17,138 +261,910 @@ DirectoryInfo DirectoryCounter::Run()
 {
     DirectoryInfo info = {};
 
-    // create a file info struct for the counts of the totals
-    CountInfo total = {};
-    total.language  = "Totals";
+    size_t newConfigs = 0; // the amount of new configs loaded as the directory was walked
+
+    Entry dir = GetFSEntry(m_path);
+
+    if (!dir.isDirectory)
+    {
+        Fatal("Path to count from must be directory!");
+    }
+
+    m_path = dir.fullPath; // set the base path to the full canonical path
+
+    ParseConfigAtEntry(dir, newConfigs); // attempt to parse a config at the root before walking paths
+
+    // both reading directories and counting files is done on a fixed amount of workers, made for this run unless a
+    // pool was set to be shared between runs
+    std::unique_ptr<ThreadPool> ownedPool((m_pool == nullptr) ? new ThreadPool(m_config->GetJobs()) : nullptr);
+
+    ThreadPool& pool = (m_pool != nullptr) ? *m_pool : *ownedPool;
+
+    WalkJob job(pool);
+
+#ifndef _WIN32
+    job.root = open(m_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    job.rootLength = m_path.size() + 1;
+#endif
+
+    uint32_t root = job.tree.AddRoot(m_path);
+
+    job.pathStart = m_path.size() + 1;
+
+    // taken before anything is looked at, so a file changed during the run is never cached as it was before
+    int64_t startTime = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+
+    CountCache cache;
+
+    ContentTable contents;
+
+    if (m_config->GetDedupe())
+    {
+        job.contents = &contents;
+    }
+
+    // files from a git index are never stamped, so caching them would only throw away the cache of a walk
+    if (!m_config->GetCachePath().empty() && !m_config->GetUseGitIndex())
+    {
+        cache.Load(m_config->GetCachePath(), m_path);
+
+        job.cache = &cache;
+    }
+
+    if (m_fileVisitor)
+    {
+        job.fileVisitor = &m_fileVisitor;
+    }
+
+    job.followLinks = m_config->GetFollowSymlinks();
+
+    for (auto& reader : job.readers)
+    {
+        reader.SetFollowLinks(job.followLinks);
+    }
+
+    if (m_config->GetUseGitIndex())
+    {
+        info.fromGitIndex = _ReadGitIndex(job, root);
+
+        if (!info.fromGitIndex)
+        {
+            fmt::print("Could not read a git index for {}, walking the directory instead\n", m_path);
+        }
+    }
+
+    std::shared_ptr<const IgnoreScope> ignores = nullptr;
+
+    if (!info.fromGitIndex && m_config->GetGitIgnore())
+    {
+        std::string globalPath = GetGlobalExcludesPath();
+
+        if (!globalPath.empty())
+        {
+            job.globalIgnores.AddFile(globalPath);
+        }
+
+        ignores = _GetParentIgnores(job.globalIgnores);
+    }
+
+    // the config keeps changing as more are found, so the walk works from copies that are never changed once made
+    if (!info.fromGitIndex)
+    {
+        job.directories.push_back(QueuedDirectory { root, std::make_shared<Config>(*m_config), ignores });
+    }
+
+    // only allow a few tasks per worker to be waiting, which stalls the walk if it gets too far ahead of counting
+    size_t maxPending = pool.GetSize() * 4;
+
+    {
+        std::unique_lock<std::mutex> lock(job.mutex);
+
+        while (true)
+        {
+            job.changed.wait(lock, [&job]() { return !job.directories.empty() || job.activeWalkers == 0; });
+
+            if (job.directories.empty())
+            {
+                break; // nothing is queued and nothing is being read that could queue more
+            }
+
+            QueuedDirectory directory = std::move(job.directories.front());
+
+            job.directories.pop_front();
+
+            job.activeWalkers++;
+
+            lock.unlock();
+
+            pool.WaitForRoom(maxPending);
+
+            pool.Submit([this, &job, directory](size_t worker) {
+                _WalkDirectory(job, directory.node, directory.config, directory.ignores, worker);
+
+                std::lock_guard<std::mutex> walkLock(job.mutex);
+
+                job.activeWalkers--;
+
+                job.changed.notify_one();
+            });
+
+            lock.lock();
+        }
+    }
+
+    // the walk is over, so send off what is left in the batch of each worker
+    for (size_t worker = 0; worker < pool.GetSize(); worker++)
+    {
+        _SubmitBatch(job, worker);
+    }
+
+    // files without a language might have gotten one from a config found later in the walk, so they were held until
+    // now to be counted with every language that was found, largest first
+    std::vector<HeldFile> unclassified;
+
+    for (auto& files : job.unclassified)
+    {
+        unclassified.insert(unclassified.end(), files.begin(), files.end());
+    }
+
+    std::stable_sort(unclassified.begin(), unclassified.end(), [&job](const HeldFile& left, const HeldFile& right) {
+        return job.tree.GetFileSize(left.node) > job.tree.GetFileSize(right.node);
+    });
+
+    // no walk tasks are left, so the batch slot of the first worker is free to fill from this thread
+    for (const HeldFile& file : unclassified)
+    {
+        std::shared_ptr<CountBatch>& batch = job.batches[0];
+
+        if (batch == nullptr)
+        {
+            batch = std::make_shared<CountBatch>();
+
+            batch->config = m_config;
+        }
+
+        if (job.cache != nullptr)
+        {
+            batch->stamps.push_back(file.stamp);
+        }
+
+        if (batch->Add(file.node, job.tree.GetFileSize(file.node), m_config->GetBatchSize()))
+        {
+            _SubmitBatch(job, 0);
+        }
+    }
+
+    _SubmitBatch(job, 0);
+
+    pool.Wait();
+
+    _MergeTotals(job, info);
+
+#ifndef _WIN32
+    if (job.root >= 0)
+    {
+        close(job.root);
+
+        info.walkSyscalls += 2; // opening and closing the root
+    }
+#endif
+
+    if (job.cache != nullptr)
+    {
+        info.usedCache = true;
+
+        for (size_t hits : job.cacheHits)
+        {
+            info.cacheHits += hits;
+        }
+
+        cache.Close();
+
+        if (!CountCache::Write(m_config->GetCachePath(), m_path, job.updates, startTime))
+        {
+            fmt::print("Failed to write the count cache at path: {}\n", m_config->GetCachePath());
+        }
+    }
+
+    info.dedupedFiles = contents.GetDuplicates();
+    info.dedupedBytes = contents.GetBytesSaved();
+
+    info.duplicates    = job.duplicates;
+    info.walkedEntries = job.tree.GetSize();
+    info.walkMemory    = job.tree.GetMemoryUsage();
+
+    for (auto& reader : job.readers)
+    {
+        info.walkSyscalls += reader.GetSyscalls();
+    }
+
+    return info;
+}
+
+DirectoryInfo DirectoryCounter::RunFromList(std::istream& list)
+{
+    DirectoryInfo info = {};
+
+    size_t newConfigs = 0;
+
+    Entry dir = GetFSEntry(m_path);
+
+    // the list is counted the same as a walk from the directory, so its config is still used for the languages
+    if (dir.isDirectory)
+    {
+        m_path = dir.fullPath;
+
+        ParseConfigAtEntry(dir, newConfigs);
+    }
+
+    std::unique_ptr<ThreadPool> ownedPool((m_pool == nullptr) ? new ThreadPool(m_config->GetJobs()) : nullptr);
+
+    ThreadPool& pool = (m_pool != nullptr) ? *m_pool : *ownedPool;
+
+    WalkJob job(pool);
+
+    ContentTable contents;
+
+    if (m_config->GetDedupe())
+    {
+        job.contents = &contents;
+    }
+
+    if (m_fileVisitor)
+    {
+        job.fileVisitor = &m_fileVisitor;
+    }
+
+    // no config is found below the root, so every file is counted with every language right away
+    std::shared_ptr<Config> config = std::make_shared<Config>(*m_config);
+
+    size_t maxPending = pool.GetSize() * 4;
+
+    // whatever ends the first path is what splits every other path
+    char delimiter = '\n';
+
+    auto addPath = [&](std::string& path) {
+        static const size_t NameLength = sizeof(".sonne.json") - 1;
+
+        if (delimiter == '\n' && !path.empty() && path.back() == '\r')
+        {
+            path.pop_back();
+        }
+
+        size_t length = path.size();
+
+        // a config is skipped the same as in a walk, which is any path that ends in a config name
+        bool isConfig = length >= NameLength && path.compare(length - NameLength, NameLength, ".sonne.json") == 0;
+
+        if (isConfig && length > NameLength)
+        {
+            char before = path[length - NameLength - 1];
+
+            isConfig = (before == '/' || before == Separator);
+        }
+
+        if (path.empty() || isConfig)
+        {
+            return;
+        }
+
+        info.listedFiles++;
+
+        std::shared_ptr<CountBatch>& batch = job.batches[0];
+
+        if (batch == nullptr)
+        {
+            batch = std::make_shared<CountBatch>();
+
+            batch->config = config;
+        }
+
+        bool full = batch->Add(std::move(path), config->GetBatchSize());
+
+        // a batch is sent off before it is full whenever no worker has anything waiting and nothing more has been read
+        // yet, so counting starts with the first path instead of waiting on a slow list to fill a batch
+        if (full || (pool.GetQueued() == 0 && list.rdbuf()->in_avail() <= 0))
+        {
+            pool.WaitForRoom(maxPending);
+
+            _SubmitBatch(job, 0);
+        }
+    };
+
+    std::string path;
+
+    int character = 0;
+
+    while ((character = list.get()) != std::char_traits<char>::eof() && character != '\0' && character != '\n')
+    {
+        path.push_back(static_cast<char>(character));
+    }
+
+    if (character == '\0')
+    {
+        delimiter = '\0';
+    }
+
+    addPath(path);
+
+    while (std::getline(list, path, delimiter))
+    {
+        addPath(path);
+    }
+
+    _SubmitBatch(job, 0);
+
+    pool.Wait();
+
+    _MergeTotals(job, info);
+
+    info.dedupedFiles = contents.GetDuplicates();
+    info.dedupedBytes = contents.GetBytesSaved();
+
+    return info;
+}
+
+void DirectoryCounter::_MergeTotals(WalkJob& job, DirectoryInfo& info)
+{
+    CountInfo total = {};
+
+    total.language = "Totals";
+    total.files    = 0; // make sure the total doesn't start with any file counts
+
+    // merge the per-worker totals together, which only costs the amount of workers times languages
+    for (auto& worker : job.totals)
+    {
+        for (auto& language : worker.totals)
+        {
+            info.Add(language.second);
+
+            total += language.second;
+        }
+    }
+
+    info.totals.insert(std::make_pair("Totals", total));
+}
+
+void DirectoryCounter::_WalkDirectory(
+    WalkJob& job,
+    uint32_t directory,
+    std::shared_ptr<Config> config,
+    std::shared_ptr<const IgnoreScope> ignores,
+    size_t worker)
+{
+    std::string path;
+
+    job.tree.GetPath(directory, path);
+
+    bool isRoot = (job.tree.GetParent(directory) == FileTree::NoParent);
+
+    DirectoryReader& reader = job.readers[worker];
+
+    if (!reader.Open(path, isRoot ? -1 : job.root, job.rootLength))
+    {
+        fmt::print("Failed to open directory at path: {}\n", path);
+
+        return;
+    }
+
+    // a directory reached again through a link has already been walked, or is still being walked when it is a loop
+    if (job.followLinks)
+    {
+        uint64_t device = 0;
+        uint64_t inode  = 0;
+
+        if (reader.GetIdentity(device, inode) && !job.identities.Insert(device, inode))
+        {
+            reader.Close();
+
+            job.duplicates++;
+
+            return;
+        }
+    }
+
+    // a config in this directory applies to everything below it, on top of the configs above it, the root config
+    // was already parsed before the walk started
+    if (!isRoot && reader.Contains(".sonne.json"))
+    {
+        std::string configPath = fmt::format("{}/.sonne.json", path);
+
+        std::shared_ptr<Config> scoped = std::make_shared<Config>(*config);
+
+        scoped->Parse(configPath);
+
+        // only the languages of a config are used by the whole walk, the rest of it stays with its own directory
+        {
+            std::lock_guard<std::mutex> lock(job.configMutex);
+
+            m_config->AddLanguages(*scoped);
+        }
+
+        job.configs++;
+
+        config = scoped;
+    }
+
+    if (config->GetGitIgnore())
+    {
+        // the top of a repository does not inherit the rules of a repository it might be inside of
+        bool isRepository = reader.Contains(".git");
+        bool hasIgnore    = reader.Contains(".gitignore");
+
+        if (isRepository || hasIgnore)
+        {
+            std::shared_ptr<IgnoreScope> scope = std::make_shared<IgnoreScope>();
+
+            scope->parent     = isRepository ? nullptr : ignores;
+            scope->baseLength = path.size() + 1;
+
+            // rules added later win, so the excludes go in before the ignore file of the directory
+            if (isRepository)
+            {
+                scope->matcher = job.globalIgnores;
+
+                scope->matcher.AddFile(fmt::format("{}/.git/info/exclude", path));
+            }
+
+            if (hasIgnore)
+            {
+                scope->matcher.AddFile(fmt::format("{}/.gitignore", path));
+            }
+
+            ignores = scope;
+        }
+    }
+
+    if (m_directoryVisitor)
+    {
+        m_directoryVisitor(path, config, ignores);
+    }
+
+    size_t ignored = 0;
 
-    total.files = 0; // make sure the total doesn't start with any file counts
+    // entries are added to the tree a chunk at a time, so a huge directory is never held in memory all at once
+    std::vector<FileTree::Pending> pending;
 
-    size_t ignoredFiles = 0; // the amount of files/directories ignored by the user configs
-    size_t newConfigs   = 0; // the amount of new configs loaded as the directory was walked
+    // what each pending file looked like, which stays blank for directories
+    std::vector<FileStamp> stamps;
 
-    Entry dir = GetFSEntry(m_path);
+    pending.reserve(256);
+    stamps.reserve(256);
 
-    if (!dir.isDirectory)
-    {
-        Fatal("Path to count from must be directory!");
-    }
+    auto addPending = [&]() {
+        uint32_t first = job.tree.AddChildren(directory, pending);
 
-    m_path = dir.fullPath; // set the base path to the full canonical path
+        for (size_t index = 0; index < pending.size(); index++)
+        {
+            FileTree::Pending& child = pending[index];
 
-    ParseConfigAtEntry(dir, newConfigs); // attempt to parse a config at the root before walking paths
+            uint32_t node = first + static_cast<uint32_t>(index);
+
+            if (child.isDirectory)
+            {
+                std::lock_guard<std::mutex> lock(job.mutex);
 
-    std::vector<Entry> entries = WalkDirectory(m_path);
-    
-    std::vector<std::string> paths;
+                job.directories.push_back(QueuedDirectory { node, config, ignores });
 
-    WalkForPaths(entries, paths, newConfigs, ignoredFiles);
-    
-    std::vector<std::future<CountInfo>> countFutures;
+                job.changed.notify_one();
 
-    for (size_t index = 0; index < paths.size(); index++)
-    {
-        std::string& path = paths.at(index);
+                continue;
+            }
+
+            _QueueFile(job, node, child.name, stamps[index], config, worker);
+        }
 
-        Counter counter(path);
+        pending.clear();
+        stamps.clear();
+    };
 
-        countFutures.push_back(std::async(std::launch::async, &Counter::Count, counter, m_config));
-    }
+    Entry entry;
 
-    // go through each async future that is currently in the vector and try and tally the counts together
-    //
-    // main thread acts as a tally for all the counters on the other async threads.
-    while (!countFutures.empty())
+    while (reader.Next(entry))
     {
-        auto& future = countFutures.front();
+        if (_ShouldSkip(entry, *config, ignored, ignores.get()))
+        {
+            continue;
+        }
+
+        // the same file reached by another link or a hard link is only counted the first time it is found
+        bool isFile = !entry.isDirectory && entry.inode != 0;
 
-        // little hack to check if future is ready immediately rather than in the future
-        if (future.wait_for(std::chrono::milliseconds(1)) != std::future_status::ready && future.valid())
+        if (job.followLinks && isFile && !job.identities.Insert(entry.device, entry.inode))
         {
-            std::swap(countFutures.front(), countFutures.back()); // swap the beginning with the end to get a new entry and continue
+            job.duplicates++;
 
             continue;
         }
 
-        CountInfo count = future.get();
+        std::string& name = entry.fileName;
 
-        // if this language has occurred before in the counter, just append to the counts for that language
-        if (info.totals.count(count.language) > 0)
+        // directory names have a separator on the end, which the tree adds back when building paths
+        if (entry.isDirectory && !name.empty() && name.back() == Separator)
         {
-            auto find = info.totals.find(count.language);
-
-            find->second += count;
+            name.pop_back();
         }
-        // otherwise insert the first count struct to the totals
-        else
+
+        FileStamp stamp;
+
+        if (!entry.isDirectory)
         {
-            info.totals.insert(std::make_pair(
-                count.language,
-                count
-            ));
+            stamp.fileSize     = entry.fileSize;
+            stamp.modifiedTime = entry.modifiedTime;
+            stamp.inode        = entry.inode;
         }
 
-        // tally up the totals
-        total += count;
+        pending.push_back(FileTree::Pending { std::move(name), entry.fileSize, entry.isDirectory });
+
+        stamps.push_back(stamp);
 
-        std::swap(future, countFutures.back());
-        countFutures.pop_back();
+        if (pending.size() == pending.capacity())
+        {
+            addPending();
+        }
     }
 
-    info.totals.insert(std::make_pair("Totals", total));
+    reader.Close();
 
-    return info;
+    addPending();
+
+    job.ignored += ignored;
 }
 
-void DirectoryCounter::WalkForPaths(
-    std::vector<Entry>& entries,
-    std::vector<std::string>& paths,
-    size_t& configs,
-    size_t& ignored)
+bool DirectoryCounter::_ReadGitIndex(WalkJob& job, uint32_t root)
 {
-    for (size_t index = 0; index < entries.size(); index++)
+    // paths in the index are relative to the top of the work tree, which may be above the root
+    std::string top = m_path;
+
+    std::string gitDirectory = FindGitDirectory(top);
+
+    while (gitDirectory.empty())
     {
-        Entry& entry = entries.at(index);
+        size_t last = top.find_last_of(Separator);
+
+        if (last == std::string::npos || top.empty())
+        {
+            return false;
+        }
+
+        top = top.substr(0, last);
+
+        gitDirectory = FindGitDirectory(top);
+    }
+
+    // only the part of the index below the root is counted, which is every path that starts with this
+    std::string prefix = (m_path.size() > top.size()) ? m_path.substr(top.size() + 1) + "/" : "";
+
+    std::replace(prefix.begin(), prefix.end(), Separator, '/');
+
+    auto toFullPath = [this](const char* path, size_t length) {
+        std::string fullPath = m_path + Separator;
+
+        fullPath.append(path, length);
 
-        // ignore by default if hidden and ignoring hidden
-        bool ignore = (entry.isHidden && m_config->GetIgnoreHidden());
+        std::replace(fullPath.begin() + m_path.size(), fullPath.end(), '/', Separator);
 
-        // skip a config file if it comes up
-        if (entry.fileName == ".sonne.json")
+        return fullPath;
+    };
+
+    // the config at the root was parsed before the walk, and the configs found below it only add to the whole walk
+    std::shared_ptr<Config> rootConfig = std::make_shared<Config>(*m_config);
+
+    struct IndexedFile
+    {
+
+        size_t offset; // where the path starts in the paths read from the index
+        size_t length;
+
+        size_t fileSize;
+
+    };
+
+    // the files of a directory can come before a config in it, so the index is read through once up front, keeping
+    // every path below the root back to back along with the tracked configs, before any file is queued
+    std::string paths;
+
+    std::vector<IndexedFile> files;
+
+    std::vector<std::string> configDirectories;
+
+    bool read = ReadGitIndex(gitDirectory, [&](const GitIndexEntry& file) {
+        static const size_t NameLength = sizeof(".sonne.json") - 1;
+
+        if (file.pathLength <= prefix.size() || prefix.compare(0, prefix.size(), file.path, prefix.size()) != 0)
         {
-            continue;
+            return;
         }
 
-        // check if this path is in the ignore path, and if so continue
-        for (auto& kv : m_config->GetIgnored())
+        const char* path = file.path + prefix.size();
+
+        size_t length = file.pathLength - prefix.size();
+
+        if (length >= NameLength)
         {
-            std::string key = kv.first;
+            const char* name = path + length - NameLength;
 
-            if (key.find('/') != std::string::npos && Separator == '\\')
+            if (std::memcmp(name, ".sonne.json", NameLength) == 0 && (name == path || name[-1] == '/'))
             {
-                std::replace(key.begin(), key.end(), '/', '\\'); // replace forward slashes with back slashes for ignore
+                configDirectories.push_back(std::string(path, name));
             }
-            else if (key.find('\\') != std::string::npos && Separator == '/')
+        }
+
+        files.push_back(IndexedFile { paths.size(), length, file.fileSize });
+
+        paths.append(path, length);
+    });
+
+    // the index is checked as a whole before any entry is visited, so nothing was kept if it failed
+    if (!read)
+    {
+        return false;
+    }
+
+    // each directory with a config is keyed by its path relative to the root with a slash on the end, and a parent
+    // always has a shorter path than its children so it is ready before them
+    std::map<std::string, std::shared_ptr<Config>> configs;
+
+    auto shorter = [](const std::string& left, const std::string& right) {
+        return left.size() < right.size();
+    };
+
+    std::stable_sort(configDirectories.begin(), configDirectories.end(), shorter);
+
+    for (const std::string& directory : configDirectories)
+    {
+        if (directory.empty())
+        {
+            continue;
+        }
+
+        std::shared_ptr<Config> parent = rootConfig;
+
+        std::string ancestor = directory;
+
+        // look for the config of the nearest directory above, falling back to the root
+        while (!ancestor.empty())
+        {
+            size_t slash = ancestor.find_last_of('/', ancestor.size() - 2);
+
+            ancestor.resize((slash == std::string::npos) ? 0 : slash + 1);
+
+            auto find = configs.find(ancestor);
+
+            if (find != configs.end())
             {
-                std::replace(key.begin(), key.end(), '\\', '/'); // replace back slashes with forward slashes for ignore
+                parent = find->second;
+
+                break;
             }
+        }
+
+        std::string configPath = toFullPath(directory.c_str(), directory.size()) + ".sonne.json";
+
+        std::shared_ptr<Config> scoped = std::make_shared<Config>(*parent);
+
+        scoped->Parse(configPath);
+
+        m_config->AddLanguages(*scoped);
+
+        job.configs++;
+
+        configs.insert(std::make_pair(directory, scoped));
+    }
+
+    // the directories leading to the current file, from the root down, with the length of each one's relative path
+    std::vector<uint32_t> nodes = { root };
+    std::vector<size_t> lengths = { 0 };
+
+    std::vector<std::shared_ptr<Config>> scopes = { rootConfig };
+
+    std::string directory = "";
 
-            // grab a substring of the file path without the root path for matching
-            std::string relativePath = entry.fullPath.substr(m_path.size() + 1, entry.fullPath.size() - m_path.size());
+    // a directory that was skipped, so everything below it is skipped as well
+    std::string skipped = "";
 
-            size_t find = relativePath.find(key);
+    size_t ignored = 0;
 
-            // the ignore was found, skip this file/dir if the ignore directive is true
-            if (find != std::string::npos)
+    std::vector<FileTree::Pending> pending;
+
+    pending.reserve(256);
+
+    // the index is read on the calling thread, which waits for the workers whenever it gets too far ahead of them
+    size_t maxPending = job.pool.GetSize() * 4;
+
+    auto addPending = [&]() {
+        if (pending.empty())
+        {
+            return;
+        }
+
+        job.pool.WaitForRoom(maxPending);
+
+        uint32_t first = job.tree.AddChildren(nodes.back(), pending);
+
+        for (size_t index = 0; index < pending.size(); index++)
+        {
+            uint32_t node = first + static_cast<uint32_t>(index);
+
+            FileStamp stamp;
+
+            stamp.fileSize = pending[index].fileSize;
+
+            _QueueFile(job, node, pending[index].name, stamp, scopes.back(), 0);
+        }
+
+        pending.clear();
+    };
+
+    Entry entry;
+
+    auto addFile = [&](const char* path, size_t length, size_t fileSize) {
+        if (!skipped.empty() && length > skipped.size() && skipped.compare(0, skipped.size(), path, skipped.size()) == 0)
+        {
+            return;
+        }
+
+        size_t nameStart = length;
+
+        while (nameStart > 0 && path[nameStart - 1] != '/')
+        {
+            nameStart--;
+        }
+
+        // the index is sorted by path, so every file of a directory comes before the index moves on past it
+        if (nameStart != directory.size() || directory.compare(0, nameStart, path, nameStart) != 0)
+        {
+            addPending();
+
+            while (lengths.back() > nameStart || directory.compare(0, lengths.back(), path, lengths.back()) != 0)
             {
-                ignored++;
+                nodes.pop_back();
+                lengths.pop_back();
+                scopes.pop_back();
+            }
 
-                ignore = true;
+            directory.assign(path, lengths.back());
 
-                break;
+            // add each directory between the deepest one kept and the one the file is in, checking it as the walk would
+            while (directory.size() < nameStart)
+            {
+                size_t end = std::find(path + directory.size(), path + nameStart, '/') - path;
+
+                std::string name(path + directory.size(), path + end);
+
+                entry.fullPath    = toFullPath(path, end);
+                entry.fileName    = name + Separator;
+                entry.isDirectory = true;
+                entry.isHidden    = (name[0] == '.');
+                entry.fileSize    = 0;
+
+                if (_ShouldSkip(entry, *scopes.back(), ignored))
+                {
+                    skipped.assign(path, end + 1);
+
+                    return;
+                }
+
+                uint32_t node = job.tree.AddChildren(nodes.back(), { FileTree::Pending { std::move(name), 0, true } });
+
+                directory.assign(path, end + 1);
+
+                auto find = configs.find(directory);
+
+                nodes.push_back(node);
+                lengths.push_back(directory.size());
+                scopes.push_back((find != configs.end()) ? find->second : scopes.back());
             }
         }
 
-        if (ignore)
+        skipped.clear();
+
+        entry.fullPath    = toFullPath(path, length);
+        entry.fileName    = std::string(path + nameStart, path + length);
+        entry.isDirectory = false;
+        entry.isHidden    = (entry.fileName[0] == '.');
+        entry.fileSize    = fileSize;
+
+        if (_ShouldSkip(entry, *scopes.back(), ignored))
+        {
+            return;
+        }
+
+        pending.push_back(FileTree::Pending { entry.fileName, fileSize, false });
+
+        if (pending.size() == pending.capacity())
+        {
+            addPending();
+        }
+    };
+
+    for (const IndexedFile& file : files)
+    {
+        addFile(paths.data() + file.offset, file.length, file.fileSize);
+    }
+
+    addPending();
+
+    job.ignored += ignored;
+
+    // the sizes in the index are from when each file was staged, so they are checked again as each file is opened
+    job.exactSizes = false;
+
+    return true;
+}
+
+void DirectoryCounter::_QueueFile(
+    WalkJob& job,
+    uint32_t node,
+    const std::string& name,
+    const FileStamp& stamp,
+    const std::shared_ptr<Config>& config,
+    size_t worker)
+{
+    // languages are only ever added, so a file that already has one is counted with it right away
+    if (!config->HasLanguage(Counter::GetExtension(name)))
+    {
+        job.unclassified[worker].push_back(HeldFile { node, stamp });
+
+        return;
+    }
+
+    std::shared_ptr<CountBatch>& batch = job.batches[worker];
+
+    // a batch is counted with a single config, so it is sent off when the config changes
+    if (batch != nullptr && batch->config != config)
+    {
+        _SubmitBatch(job, worker);
+    }
+
+    if (batch == nullptr)
+    {
+        batch = std::make_shared<CountBatch>();
+
+        batch->config = config;
+    }
+
+    if (job.cache != nullptr)
+    {
+        batch->stamps.push_back(stamp);
+    }
+
+    if (batch->Add(node, stamp.fileSize, config->GetBatchSize()))
+    {
+        _SubmitBatch(job, worker);
+    }
+}
+
+void DirectoryCounter::_SubmitBatch(WalkJob& job, size_t worker)
+{
+    std::shared_ptr<CountBatch> batch = std::move(job.batches[worker]);
+
+    job.batches[worker] = nullptr;
+
+    if (batch == nullptr || (batch->files.empty() && batch->paths.empty()))
+    {
+        return;
+    }
+
+    WalkJob* walk = &job;
+
+    // only capture a pointer and the batch so that the task fits in the small buffer of std::function
+    job.pool.Submit([walk, batch](size_t worker) { walk->Count(*batch, worker); });
+}
+
+void DirectoryCounter::WalkForPaths(
+    std::vector<Entry>& entries,
+    std::vector<std::string>& paths,
+    size_t& configs,
+    size_t& ignored)
+{
+    for (size_t index = 0; index < entries.size(); index++)
+    {
+        Entry& entry = entries.at(index);
+
+        if (_ShouldSkip(entry, *m_config, ignored))
         {
             continue; // contine if the file or directory is ignored
         }
@@ -170,6 +1186,58 @@ void DirectoryCounter::WalkForPaths(
     }
 }
 
+bool DirectoryCounter::IsSkipped(const Entry& entry, const Config& config, const IgnoreScope* ignores)
+{
+    size_t ignored = 0;
+
+    return _ShouldSkip(entry, config, ignored, ignores);
+}
+
+bool DirectoryCounter::_ShouldSkip(const Entry& entry, const Config& config, size_t& ignored, const IgnoreScope* ignores)
+{
+    // ignore by default if hidden and ignoring hidden
+    bool ignore = (entry.isHidden && config.GetIgnoreHidden());
+
+    // skip a config file if it comes up
+    if (entry.fileName == ".sonne.json")
+    {
+        return true;
+    }
+
+    const IgnoreMatcher* matcher = config.GetIgnoreMatcher();
+
+    // match the path relative to the root, which points into the full path rather than copying it
+    if (matcher != nullptr && entry.fullPath.size() > m_path.size() + 1)
+    {
+        const char* relativePath = entry.fullPath.c_str() + m_path.size() + 1;
+
+        if (matcher->IsIgnored(relativePath, entry.fullPath.size() - m_path.size() - 1, entry.isDirectory))
+        {
+            ignored++;
+
+            ignore = true;
+        }
+    }
+
+    if (config.GetGitIgnore())
+    {
+        // git never looks inside of its own directory, which is only otherwise skipped for being hidden
+        if (entry.isDirectory && entry.fileName.size() == 5 && entry.fileName.compare(0, 4, ".git") == 0)
+        {
+            return true;
+        }
+
+        if (!ignore && ignores != nullptr && ignores->Match(entry.fullPath, entry.isDirectory) == IgnoreResult::IGNORED)
+        {
+            ignored++;
+
+            ignore = true;
+        }
+    }
+
+    return ignore;
+}
+
 void DirectoryCounter::ParseConfigAtEntry(Entry& entry, size_t& configs)
 {
     // if this is a directory, check if there is a config to load, then recurse
@@ -191,4 +1259,73 @@ void DirectoryCounter::ParseConfigAtEntry(Entry& entry, size_t& configs)
 
         configs++;
     }
-}
\ No newline at end of file
+}
+
+std::shared_ptr<const IgnoreScope> DirectoryCounter::_GetParentIgnores(const IgnoreMatcher& global)
+{
+    // the root of the walk checks for a repository itself, so only the directories above it are looked at here
+    if (GetFSEntry(fmt::format("{}/.git", m_path)).isValid)
+    {
+        return nullptr;
+    }
+
+    std::vector<std::string> parents;
+
+    std::string current = m_path;
+
+    bool found = false;
+
+    while (!found)
+    {
+        size_t last = current.find_last_of(Separator);
+
+        if (last == std::string::npos)
+        {
+            break;
+        }
+
+        current = current.substr(0, last);
+
+        parents.push_back(current);
+
+        // the filesystem root is the blank path before the first separator
+        found = GetFSEntry(fmt::format("{}/.git", current)).isValid;
+
+        if (current.empty())
+        {
+            break;
+        }
+    }
+
+    if (!found)
+    {
+        return nullptr;
+    }
+
+    std::shared_ptr<const IgnoreScope> ignores = nullptr;
+
+    // build the scopes from the top of the repository down to the parent of the root
+    for (auto parent = parents.rbegin(); parent != parents.rend(); parent++)
+    {
+        std::shared_ptr<IgnoreScope> scope = std::make_shared<IgnoreScope>();
+
+        scope->parent     = ignores;
+        scope->baseLength = parent->size() + 1;
+
+        if (parent == parents.rbegin())
+        {
+            scope->matcher = global;
+
+            scope->matcher.AddFile(fmt::format("{}/.git/info/exclude", *parent));
+        }
+
+        scope->matcher.AddFile(fmt::format("{}/.gitignore", *parent));
+
+        if (!scope->matcher.IsEmpty())
+        {
+            ignores = scope;
+        }
+    }
+
+    return ignores;
+}
@@ -26,6 +26,14 @@ void Sonne::SetEntryFromHandle(
 
     entry.fileSize = static_cast<size_t>(fileSizeLarge.QuadPart);
 
+    ULARGE_INTEGER writeTime;
+
+    writeTime.HighPart = data.ftLastWriteTime.dwHighDateTime;
+    writeTime.LowPart  = data.ftLastWriteTime.dwLowDateTime;
+
+    // file times count 100 nanosecond steps from 1601, which is this many steps before the unix epoch
+    entry.modifiedTime = (static_cast<int64_t>(writeTime.QuadPart) - 116444736000000000LL) * 100;
+
     // grab the full path for the file to save in the entry
     if (grabFullPath)
     {
@@ -45,6 +53,18 @@ void Sonne::SetEntryFromHandle(
         entry.fullPath = std::string(canonicalPath, length);
     }
 }
+#else
+/**
+ Grab the time a file was last modified from a stat, in nanoseconds since the unix epoch.
+ */
+static int64_t GetModifiedTime(const struct stat& statBuffer)
+{
+#ifdef __APPLE__
+    return statBuffer.st_mtimespec.tv_sec * 1000000000LL + statBuffer.st_mtimespec.tv_nsec;
+#else
+    return statBuffer.st_mtim.tv_sec * 1000000000LL + statBuffer.st_mtim.tv_nsec;
+#endif
+}
 #endif
 
 std::string Sonne::GetRunningPath()
@@ -247,10 +267,44 @@ Entry Sonne::GetNextEntry(const std::string& rootDir, Entry& previous)
         next.isHidden = true;
     }
 
+    next.isSymlink = (direntEntry->d_type == DT_LNK);
+
     if (direntEntry->d_type == DT_DIR)
     {
         next.isDirectory = true;
     }
+    else
+    {
+        // grab the size of files while the directory is open, so that the counter does not have to stat them again
+        struct stat statBuffer;
+
+        if (fstatat(dirfd(previous.direntHandle), direntEntry->d_name, &statBuffer, 0) < 0)
+        {
+            next.isValid = false; // most likely a broken symlink, which has nothing to count
+
+            return next;
+        }
+
+        // some filesystems do not fill in the type, and links to directories are not walked into unless asked for
+        if (S_ISDIR(statBuffer.st_mode))
+        {
+            next.isDirectory = true;
+            next.isValid     = (direntEntry->d_type == DT_UNKNOWN);
+        }
+        else if (!S_ISREG(statBuffer.st_mode))
+        {
+            next.isValid = false; // fifos, sockets and devices have nothing to count and can block when opened
+
+            return next;
+        }
+
+        next.fileSize = static_cast<size_t>(statBuffer.st_size);
+
+        next.device = static_cast<uint64_t>(statBuffer.st_dev);
+        next.inode  = static_cast<uint64_t>(statBuffer.st_ino);
+
+        next.modifiedTime = GetModifiedTime(statBuffer);
+    }
 
     next.fileName = std::string(direntEntry->d_name);
 
@@ -304,7 +358,7 @@ std::vector<Entry> Sonne::WalkDirectory(std::string path)
             break;
         }
 
-        if (next.isSpecialDirectory)
+        if (next.isSpecialDirectory || !next.isValid)
         {
             continue;
         }
@@ -320,3 +374,757 @@ std::vector<Entry> Sonne::WalkDirectory(std::string path)
 
     return entries;
 }
+
+DirectoryReader::~DirectoryReader()
+{
+    Close();
+}
+
+#ifdef __linux__
+bool DirectoryReader::Open(const std::string& path, int directory, size_t nameOffset)
+{
+    Close();
+
+    m_path = path;
+
+    if (m_buffer == nullptr)
+    {
+        m_buffer.reset(new char[BufferSize]);
+    }
+
+    const char* openPath = (directory >= 0 && nameOffset < path.size()) ? path.c_str() + nameOffset : path.c_str();
+
+    m_directory = openat(
+        (directory >= 0) ? directory : AT_FDCWD,
+        openPath,
+        O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    m_syscalls++;
+
+    if (m_directory < 0)
+    {
+        return false;
+    }
+
+    m_complete = false;
+
+    if (!_Read())
+    {
+        Close();
+
+        return false;
+    }
+
+    m_whole = m_complete;
+
+    return true;
+}
+
+bool DirectoryReader::Next(Entry& entry)
+{
+    while (true)
+    {
+        if (m_offset >= m_size)
+        {
+            if (m_complete || !_Read() || m_size == 0)
+            {
+                return false;
+            }
+        }
+
+        const dirent64* record = reinterpret_cast<const dirent64*>(m_buffer.get() + m_offset);
+
+        m_offset += record->d_reclen;
+
+        const char* name = record->d_name;
+
+        if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+        {
+            continue;
+        }
+
+        unsigned char type = record->d_type;
+
+        // these can never be counted, and opening a fifo with no writer blocks forever
+        if (type == DT_FIFO || type == DT_SOCK || type == DT_CHR || type == DT_BLK)
+        {
+            continue;
+        }
+
+        entry.isValid      = true;
+        entry.isDirectory  = (type == DT_DIR);
+        entry.isHidden     = (name[0] == '.');
+        entry.isSymlink    = (type == DT_LNK);
+        entry.fileSize     = 0;
+        entry.device       = 0;
+        entry.inode        = 0;
+        entry.modifiedTime = 0;
+
+        // a regular file still needs its size, while links and unknown types need to be looked up to see what they are
+        if (!entry.isDirectory)
+        {
+            mode_t mode = 0;
+
+            bool found = false;
+
+#ifdef STATX_SIZE
+            struct statx statBuffer;
+
+            // only what the walk and the cache read is asked for, the device is always filled in
+            static constexpr unsigned int StatxMask = STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_INO | STATX_MTIME;
+
+            m_syscalls++;
+
+            if (statx(m_directory, name, AT_STATX_SYNC_AS_STAT, StatxMask, &statBuffer) == 0)
+            {
+                mode = statBuffer.stx_mode;
+
+                entry.fileSize = static_cast<size_t>(statBuffer.stx_size);
+
+                entry.device = static_cast<uint64_t>(makedev(statBuffer.stx_dev_major, statBuffer.stx_dev_minor));
+                entry.inode  = static_cast<uint64_t>(statBuffer.stx_ino);
+
+                entry.modifiedTime = statBuffer.stx_mtime.tv_sec * 1000000000LL + statBuffer.stx_mtime.tv_nsec;
+
+                found = true;
+            }
+            else if (errno == ENOSYS)
+#endif
+            {
+                struct stat fallback;
+
+                m_syscalls++;
+
+                if (fstatat(m_directory, name, &fallback, 0) == 0)
+                {
+                    mode = fallback.st_mode;
+
+                    entry.fileSize = static_cast<size_t>(fallback.st_size);
+
+                    entry.device = static_cast<uint64_t>(fallback.st_dev);
+                    entry.inode  = static_cast<uint64_t>(fallback.st_ino);
+
+                    entry.modifiedTime = GetModifiedTime(fallback);
+
+                    found = true;
+                }
+            }
+
+            if (!found)
+            {
+                continue; // most likely a broken symlink, which has nothing to count
+            }
+
+            // links to directories are only walked into when following links, the identity of a directory is looked
+            // up once it is opened instead
+            if (S_ISDIR(mode) && (type == DT_UNKNOWN || (type == DT_LNK && m_followLinks)))
+            {
+                entry.isDirectory = true;
+
+                entry.fileSize = 0;
+                entry.device   = 0;
+                entry.inode    = 0;
+            }
+            else if (!S_ISREG(mode))
+            {
+                continue;
+            }
+        }
+
+        entry.fileName.assign(name);
+
+        entry.fullPath.reserve(m_path.size() + entry.fileName.size() + 1);
+        entry.fullPath.assign(m_path);
+        entry.fullPath += Separator;
+        entry.fullPath += entry.fileName;
+
+        // append a separator to the file name if this is a directory, the same as GetNextEntry
+        if (entry.isDirectory)
+        {
+            entry.fileName += Separator;
+        }
+
+        return true;
+    }
+}
+
+bool DirectoryReader::GetIdentity(uint64_t& device, uint64_t& inode)
+{
+    struct stat statBuffer;
+
+    m_syscalls++;
+
+    if (m_directory < 0 || fstat(m_directory, &statBuffer) != 0)
+    {
+        return false;
+    }
+
+    device = static_cast<uint64_t>(statBuffer.st_dev);
+    inode  = static_cast<uint64_t>(statBuffer.st_ino);
+
+    return true;
+}
+
+bool DirectoryReader::Contains(const char* name)
+{
+    if (m_directory < 0)
+    {
+        return false;
+    }
+
+    if (!m_whole)
+    {
+        m_syscalls++;
+
+        return faccessat(m_directory, name, F_OK, 0) == 0;
+    }
+
+    for (size_t offset = 0; offset < m_size;)
+    {
+        const dirent64* record = reinterpret_cast<const dirent64*>(m_buffer.get() + offset);
+
+        if (std::strcmp(record->d_name, name) == 0)
+        {
+            return true;
+        }
+
+        offset += record->d_reclen;
+    }
+
+    return false;
+}
+
+void DirectoryReader::Close()
+{
+    if (m_directory >= 0)
+    {
+        close(m_directory);
+
+        m_syscalls++;
+    }
+
+    m_directory = -1;
+
+    m_offset = 0;
+    m_size   = 0;
+}
+
+bool DirectoryReader::_Read()
+{
+    m_offset = 0;
+    m_size   = 0;
+
+    // keep reading until the buffer is nearly full, the read that hits the end of the directory is needed anyway
+    while (!m_complete && BufferSize - m_size >= MinimumRead)
+    {
+        long read = syscall(SYS_getdents64, m_directory, m_buffer.get() + m_size, BufferSize - m_size);
+
+        m_syscalls++;
+
+        if (read < 0)
+        {
+            return false;
+        }
+
+        if (read == 0)
+        {
+            m_complete = true;
+        }
+
+        m_size += static_cast<size_t>(read);
+    }
+
+    return true;
+}
+#else
+bool DirectoryReader::Open(const std::string& path, int directory, size_t nameOffset)
+{
+    Close();
+
+    m_path = path;
+
+    m_syscalls++;
+
+#ifdef _WIN32
+    m_first = GetFSEntry(path + "\\*.*", false); // append a wildcard to the end on windows
+
+    m_open = m_first.isValid;
+#else
+    m_first = Entry();
+
+    // the caller already knows this is a directory, so skip the stat and realpath that GetFSEntry would do
+    m_first.direntHandle = opendir(path.c_str());
+
+    m_open = (m_first.direntHandle != nullptr);
+#endif
+
+    return m_open;
+}
+
+bool DirectoryReader::Next(Entry& entry)
+{
+    while (m_open)
+    {
+        // every entry shares the handle of the first, so that is all that has to be passed along
+        Entry next = GetNextEntry(m_path, m_first);
+
+        m_syscalls++;
+
+        if (next.findEnd)
+        {
+            m_open = false; // the handle is closed once the end is found
+
+            break;
+        }
+
+        if (next.isSpecialDirectory)
+        {
+            continue;
+        }
+
+        // a link to a directory is listed as a directory that is not valid, so it can still be taken when following
+        if (!next.isValid && !(m_followLinks && next.isSymlink && next.isDirectory))
+        {
+            continue;
+        }
+
+        next.isValid = true;
+
+        entry = std::move(next);
+
+        return true;
+    }
+
+    return false;
+}
+
+bool DirectoryReader::GetIdentity(uint64_t& device, uint64_t& inode)
+{
+#ifdef _WIN32
+    return false; // there are no inodes to compare, so nothing is ever found to be the same
+#else
+    struct stat statBuffer;
+
+    m_syscalls++;
+
+    if (!m_open || fstat(dirfd(m_first.direntHandle), &statBuffer) != 0)
+    {
+        return false;
+    }
+
+    device = static_cast<uint64_t>(statBuffer.st_dev);
+    inode  = static_cast<uint64_t>(statBuffer.st_ino);
+
+    return true;
+#endif
+}
+
+bool DirectoryReader::Contains(const char* name)
+{
+    m_syscalls++;
+
+    return GetFSEntry(fmt::format("{}{}{}", m_path, Separator, name)).isValid;
+}
+
+void DirectoryReader::Close()
+{
+    if (m_open)
+    {
+#ifdef _WIN32
+        FindClose(m_first.windowsHandle);
+#else
+        closedir(m_first.direntHandle);
+#endif
+
+        m_syscalls++;
+    }
+
+    m_open = false;
+}
+#endif
+
+char* ReadBuffer::Reserve(size_t size)
+{
+    if (size > m_capacity)
+    {
+        // grow geometrically so a run of slightly larger files does not reallocate on every read
+        size_t capacity = std::max(size, m_capacity * 2);
+
+        m_data.reset(new char[capacity]);
+
+        m_capacity = capacity;
+    }
+
+    return m_data.get();
+}
+
+FileView::~FileView()
+{
+    Close();
+}
+
+bool FileView::Open(const std::string& path, ReadBuffer& buffer, size_t mapThreshold)
+{
+    Close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFile(
+        path.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN,
+        nullptr);
+
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+
+    if (!GetFileSizeEx(file, &fileSize))
+    {
+        CloseHandle(file);
+
+        return false;
+    }
+
+    size_t size = static_cast<size_t>(fileSize.QuadPart);
+
+    if (size > 0 && size >= mapThreshold)
+    {
+        HANDLE mapping = CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+
+        void* view = (mapping != nullptr) ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+
+        if (view != nullptr)
+        {
+            CloseHandle(file); // the mapping keeps the file open on its own
+
+            m_data    = static_cast<const char*>(view);
+            m_size    = size;
+            m_mapped  = true;
+            m_mapping = mapping;
+
+            return true;
+        }
+
+        // fall back to reading the file if it could not be mapped
+        if (mapping != nullptr)
+        {
+            CloseHandle(mapping);
+        }
+    }
+
+    char* data = buffer.Reserve(size);
+
+    size_t total = 0;
+
+    while (total < size)
+    {
+        DWORD toRead = static_cast<DWORD>(std::min<size_t>(size - total, MAXDWORD));
+        DWORD bytes  = 0;
+
+        if (!ReadFile(file, data + total, toRead, &bytes, nullptr))
+        {
+            CloseHandle(file);
+
+            return false;
+        }
+
+        if (bytes == 0)
+        {
+            break; // the file shrunk while it was being read
+        }
+
+        total += static_cast<size_t>(bytes);
+    }
+
+    CloseHandle(file);
+
+    m_data = data;
+    m_size = total;
+
+    return true;
+#else
+    int file = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (file < 0)
+    {
+        return false;
+    }
+
+    struct stat statBuffer;
+
+    if (fstat(file, &statBuffer) < 0)
+    {
+        close(file);
+
+        return false;
+    }
+
+    return _ReadDescriptor(file, static_cast<size_t>(statBuffer.st_size), buffer, mapThreshold);
+#endif
+}
+
+bool FileView::Open(
+    const char* path,
+    size_t fileSize,
+    ReadBuffer& buffer,
+    size_t mapThreshold,
+    int directory,
+    bool exactSize)
+{
+#ifdef _WIN32
+    // there are no handle relative opens here, so fall back to opening by the full path
+    return Open(std::string(path), buffer, mapThreshold);
+#else
+    Close();
+
+    int file = (directory >= 0) ?
+        openat(directory, path, O_RDONLY | O_CLOEXEC) :
+        open(path, O_RDONLY | O_CLOEXEC);
+
+    if (file < 0)
+    {
+        return false;
+    }
+
+    // mapping past the end of a file that shrunk since it was walked would fault, so check before mapping it
+    if (!exactSize || (fileSize > 0 && fileSize >= mapThreshold))
+    {
+        struct stat statBuffer;
+
+        if (fstat(file, &statBuffer) < 0)
+        {
+            close(file);
+
+            return false;
+        }
+
+        fileSize = static_cast<size_t>(statBuffer.st_size);
+    }
+
+    return _ReadDescriptor(file, fileSize, buffer, mapThreshold);
+#endif
+}
+
+#ifndef _WIN32
+bool FileView::_ReadDescriptor(int file, size_t size, ReadBuffer& buffer, size_t mapThreshold)
+{
+    if (size > 0 && size >= mapThreshold)
+    {
+        void* mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+
+        if (mapped != MAP_FAILED)
+        {
+            // the counter reads front to back, so let the kernel read ahead aggressively
+            madvise(mapped, size, MADV_SEQUENTIAL);
+
+            close(file); // the mapping keeps its own reference to the file
+
+            m_data   = static_cast<const char*>(mapped);
+            m_size   = size;
+            m_mapped = true;
+
+            return true;
+        }
+
+        // fall back to reading the file if it could not be mapped, such as on some network filesystems
+    }
+
+    char* data = buffer.Reserve(size);
+
+    size_t total = 0;
+
+    while (total < size)
+    {
+        ssize_t bytes = read(file, data + total, size - total);
+
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            close(file);
+
+            return false;
+        }
+
+        if (bytes == 0)
+        {
+            break; // the file shrunk while it was being read
+        }
+
+        total += static_cast<size_t>(bytes);
+    }
+
+    close(file);
+
+    m_data = data;
+    m_size = total;
+
+    return true;
+}
+#endif
+
+void FileView::Close()
+{
+    if (m_mapped)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(m_data);
+
+        CloseHandle(m_mapping);
+
+        m_mapping = nullptr;
+#else
+        munmap(const_cast<char*>(m_data), m_size);
+#endif
+    }
+
+    m_data   = nullptr;
+    m_size   = 0;
+    m_mapped = false;
+}
+
+FileStream::~FileStream()
+{
+    Close();
+}
+
+bool FileStream::Open(const std::string& path, int directory)
+{
+    Close();
+
+#ifdef _WIN32
+    m_file = CreateFile(
+        path.c_str(),
+        GENERIC_READ,
+        FILE_SHARE_READ,
+        nullptr,
+        OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN,
+        nullptr);
+
+    if (m_file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+
+    if (!GetFileSizeEx(m_file, &fileSize))
+    {
+        Close();
+
+        return false;
+    }
+
+    m_size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    m_file = (directory >= 0) ?
+        openat(directory, path.c_str(), O_RDONLY | O_CLOEXEC) :
+        open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    if (m_file < 0)
+    {
+        return false;
+    }
+
+    struct stat statBuffer;
+
+    if (fstat(m_file, &statBuffer) < 0)
+    {
+        Close();
+
+        return false;
+    }
+
+    m_size = static_cast<size_t>(statBuffer.st_size);
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(m_file, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+#endif
+
+    return true;
+}
+
+void FileStream::Close()
+{
+#ifdef _WIN32
+    if (m_file != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(m_file);
+
+        m_file = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (m_file >= 0)
+    {
+        close(m_file);
+
+        m_file = -1;
+    }
+#endif
+
+    m_size = 0;
+}
+
+bool FileStream::ReadAt(char* destination, size_t size, size_t offset, size_t& read)
+{
+    read = 0;
+
+    while (read < size)
+    {
+#ifdef _WIN32
+        OVERLAPPED overlapped = {};
+
+        ULARGE_INTEGER position;
+
+        position.QuadPart = static_cast<ULONGLONG>(offset + read);
+
+        overlapped.Offset     = position.LowPart;
+        overlapped.OffsetHigh = position.HighPart;
+
+        DWORD toRead = static_cast<DWORD>(std::min<size_t>(size - read, MAXDWORD));
+        DWORD bytes  = 0;
+
+        if (!ReadFile(m_file, destination + read, toRead, &bytes, &overlapped))
+        {
+            if (GetLastError() == ERROR_HANDLE_EOF)
+            {
+                break;
+            }
+
+            return false;
+        }
+#else
+        ssize_t bytes = pread(m_file, destination + read, size - read, static_cast<off_t>(offset + read));
+
+        if (bytes < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return false;
+        }
+#endif
+
+        if (bytes == 0)
+        {
+            break; // hit the end of the file
+        }
+
+        read += static_cast<size_t>(bytes);
+    }
+
+    return true;
+}
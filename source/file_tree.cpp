@@ -0,0 +1,271 @@
+#include "sonne/pch.hpp"
+#include "sonne/file_tree.hpp"
+
+#include "sonne/file.hpp"
+#include "sonne/hash.hpp"
+
+using namespace Sonne;
+
+constexpr uint32_t FileTree::NoParent;
+
+/**
+ Make room for one more block pointer in a block table, swapping in a copy twice the size if it is full.
+
+ The old table is kept alive rather than freed, since a reader may have loaded it right before the swap.
+ */
+template <typename T>
+static void GrowTable(
+    std::atomic<T**>& table,
+    size_t& capacity,
+    size_t used,
+    std::vector<std::unique_ptr<T*[]>>& tables)
+{
+    if (used < capacity)
+    {
+        return;
+    }
+
+    size_t grown = std::max<size_t>(capacity * 2, 16);
+
+    std::unique_ptr<T*[]> larger(new T*[grown]());
+
+    T** current = table.load(std::memory_order_relaxed);
+
+    for (size_t index = 0; index < used; index++)
+    {
+        larger[index] = current[index];
+    }
+
+    table.store(larger.get(), std::memory_order_release);
+
+    tables.push_back(std::move(larger));
+
+    capacity = grown;
+}
+
+FileTree::FileTree()
+    :
+    m_nodeTable(nullptr),
+    m_nameTable(nullptr),
+    m_interned(1024, 0)
+{
+}
+
+FileTree::~FileTree()
+{
+}
+
+uint32_t FileTree::AddRoot(const std::string& path)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    return _AddNode(NoParent, path.data(), path.size(), 0, true);
+}
+
+uint32_t FileTree::AddChildren(uint32_t parent, const std::vector<Pending>& children)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    uint32_t first = static_cast<uint32_t>(m_nodeCount);
+
+    for (auto& child : children)
+    {
+        _AddNode(parent, child.name.data(), child.name.size(), child.fileSize, child.isDirectory);
+    }
+
+    return first;
+}
+
+void FileTree::GetPath(uint32_t node, std::string& path) const
+{
+    // measure the whole path first, so it can be filled in from the end while walking up through the parents
+    size_t length = 0;
+
+    for (uint32_t current = node; current != NoParent; current = _GetNode(current).parent)
+    {
+        length += _GetNode(current).nameLength + 1;
+    }
+
+    path.resize(length - 1);
+
+    size_t end = path.size();
+
+    for (uint32_t current = node; current != NoParent; current = _GetNode(current).parent)
+    {
+        const Node& entry = _GetNode(current);
+
+        end -= entry.nameLength;
+
+        std::memcpy(&path[end], _GetName(entry.name), entry.nameLength);
+
+        if (end > 0)
+        {
+            end--;
+
+            path[end] = Separator;
+        }
+    }
+}
+
+size_t FileTree::GetSize() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    return m_nodeCount;
+}
+
+size_t FileTree::GetMemoryUsage() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    size_t usage = sizeof(FileTree);
+
+    usage += m_nodeBlocks.size() * NodeBlockSize * sizeof(Node);
+    usage += m_nameBlocks.size() * NameBlockSize;
+
+    usage += m_nodeTableCapacity * sizeof(Node*);
+    usage += m_nameTableCapacity * sizeof(char*);
+
+    usage += m_interned.capacity() * sizeof(uint64_t);
+
+    return usage;
+}
+
+uint32_t FileTree::_AddNode(uint32_t parent, const char* name, size_t length, size_t fileSize, bool isDirectory)
+{
+    if (m_nodeCount >= NoParent)
+    {
+        Fatal("Too many entries found in the directory walk!");
+    }
+
+    if (length > 0xFFFF)
+    {
+        Fatal(fmt::format("Name of an entry is too long to store in the walk: {}", std::string(name, length)));
+    }
+
+    size_t block = m_nodeCount >> NodeBlockShift;
+
+    if (block == m_nodeBlocks.size())
+    {
+        GrowTable(m_nodeTable, m_nodeTableCapacity, m_nodeBlocks.size(), m_nodeTables);
+
+        m_nodeBlocks.push_back(std::unique_ptr<Node[]>(new Node[NodeBlockSize]));
+
+        // no reader can know about a node in this block yet, so it is safe to fill in the slot in place
+        m_nodeTable.load(std::memory_order_relaxed)[block] = m_nodeBlocks.back().get();
+    }
+
+    Node& node = m_nodeBlocks[block][m_nodeCount & (NodeBlockSize - 1)];
+
+    node.parent      = parent;
+    node.name        = _InternName(name, length);
+    node.nameLength  = static_cast<uint16_t>(length);
+    node.isDirectory = isDirectory ? 1 : 0;
+    node.fileSize    = static_cast<uint64_t>(fileSize);
+
+    return static_cast<uint32_t>(m_nodeCount++);
+}
+
+uint32_t FileTree::_InternName(const char* name, size_t length)
+{
+    size_t mask = m_interned.size() - 1;
+
+    size_t slot = static_cast<size_t>(HashBytes(name, length)) & mask;
+
+    // linear probe until either the name or an empty slot is found
+    while (m_interned[slot] != 0)
+    {
+        uint64_t packed = m_interned[slot];
+
+        uint32_t offset = static_cast<uint32_t>(packed >> 16);
+
+        if ((packed & 0xFFFF) == length && std::memcmp(_GetName(offset), name, length) == 0)
+        {
+            return offset;
+        }
+
+        slot = (slot + 1) & mask;
+    }
+
+    uint32_t offset = _StoreName(name, length);
+
+    m_interned[slot] = (static_cast<uint64_t>(offset) << 16) | length;
+
+    m_internedCount++;
+
+    if (m_internedCount * 2 > m_interned.size())
+    {
+        _GrowInterned();
+    }
+
+    return offset;
+}
+
+uint32_t FileTree::_StoreName(const char* name, size_t length)
+{
+    size_t block = m_nameEnd >> NameBlockShift;
+
+    // names never straddle two blocks, so skip to the start of the next block if this one is too full
+    if (block < m_nameBlocks.size() && (m_nameEnd & (NameBlockSize - 1)) + length > NameBlockSize)
+    {
+        block++;
+
+        m_nameEnd = block << NameBlockShift;
+    }
+
+    if (block == m_nameBlocks.size())
+    {
+        GrowTable(m_nameTable, m_nameTableCapacity, m_nameBlocks.size(), m_nameTables);
+
+        m_nameBlocks.push_back(std::unique_ptr<char[]>(new char[NameBlockSize]));
+
+        m_nameTable.load(std::memory_order_relaxed)[block] = m_nameBlocks.back().get();
+
+        // the very first byte is never handed out, so a packed name is never zero and zero can mark an empty slot
+        if (m_nameEnd == 0)
+        {
+            m_nameEnd = 1;
+        }
+    }
+
+    if (m_nameEnd + length > 0xFFFFFFFF)
+    {
+        Fatal("Too many distinct names found in the directory walk!");
+    }
+
+    uint32_t offset = static_cast<uint32_t>(m_nameEnd);
+
+    std::memcpy(m_nameBlocks[block].get() + (m_nameEnd & (NameBlockSize - 1)), name, length);
+
+    m_nameEnd += length;
+
+    return offset;
+}
+
+void FileTree::_GrowInterned()
+{
+    std::vector<uint64_t> grown(m_interned.size() * 2, 0);
+
+    size_t mask = grown.size() - 1;
+
+    for (uint64_t packed : m_interned)
+    {
+        if (packed == 0)
+        {
+            continue;
+        }
+
+        uint32_t offset = static_cast<uint32_t>(packed >> 16);
+
+        size_t slot = static_cast<size_t>(HashBytes(_GetName(offset), packed & 0xFFFF)) & mask;
+
+        while (grown[slot] != 0)
+        {
+            slot = (slot + 1) & mask;
+        }
+
+        grown[slot] = packed;
+    }
+
+    m_interned.swap(grown);
+}
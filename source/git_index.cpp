@@ -0,0 +1,314 @@
+#include "sonne/pch.hpp"
+#include "sonne/git_index.hpp"
+
+#include "sonne/file.hpp"
+
+using namespace Sonne;
+
+static inline uint32_t ReadUInt32(const unsigned char* data)
+{
+    return (static_cast<uint32_t>(data[0]) << 24) |
+        (static_cast<uint32_t>(data[1]) << 16) |
+        (static_cast<uint32_t>(data[2]) << 8) |
+        static_cast<uint32_t>(data[3]);
+}
+
+static inline uint16_t ReadUInt16(const unsigned char* data)
+{
+    return static_cast<uint16_t>((data[0] << 8) | data[1]);
+}
+
+static std::string TrimLine(const std::string& line)
+{
+    size_t start = line.find_first_not_of(" \t\r\n");
+
+    if (start == std::string::npos)
+    {
+        return "";
+    }
+
+    return line.substr(start, line.find_last_not_of(" \t\r\n") - start + 1);
+}
+
+/**
+ The size of an object name in the repository, which is larger when `extensions.objectFormat` is SHA-256.
+ */
+static size_t GetHashSize(const std::string& gitDirectory)
+{
+    std::ifstream in(fmt::format("{}/config", gitDirectory));
+
+    std::string line;
+
+    bool inExtensions = false;
+
+    while (std::getline(in, line))
+    {
+        line = TrimLine(line);
+
+        std::transform(line.begin(), line.end(), line.begin(), [](char character) {
+            return (character >= 'A' && character <= 'Z') ? static_cast<char>(character - 'A' + 'a') : character;
+        });
+
+        if (!line.empty() && line[0] == '[')
+        {
+            inExtensions = (line.compare(0, 12, "[extensions]") == 0);
+
+            continue;
+        }
+
+        size_t equals = line.find('=');
+
+        if (inExtensions && equals != std::string::npos && TrimLine(line.substr(0, equals)) == "objectformat")
+        {
+            return (TrimLine(line.substr(equals + 1)) == "sha256") ? 32 : 20;
+        }
+    }
+
+    return 20;
+}
+
+/**
+ Decode the variable length offset that prefixes each path in a version 4 index.
+ */
+static bool ReadOffset(const unsigned char*& data, const unsigned char* end, size_t& value)
+{
+    if (data >= end)
+    {
+        return false;
+    }
+
+    unsigned char current = *data++;
+
+    value = current & 0x7F;
+
+    while (current & 0x80)
+    {
+        if (data >= end)
+        {
+            return false;
+        }
+
+        current = *data++;
+
+        value = ((value + 1) << 7) | (current & 0x7F);
+    }
+
+    return true;
+}
+
+/**
+ Walk every entry of the index from the first entry up to the extensions, returning where the extensions begin.
+
+ When a visitor is given each regular file is handed to it, otherwise the entries are only stepped over.
+ */
+static bool ReadEntries(
+    const unsigned char* data,
+    size_t size,
+    size_t hashSize,
+    size_t& extensions,
+    const std::function<void(const GitIndexEntry&)>* visitor)
+{
+    uint32_t version = ReadUInt32(data + 4);
+    uint32_t count   = ReadUInt32(data + 8);
+
+    const unsigned char* end = data + size;
+
+    // the fixed part of an entry: ten 32 bit stat fields, the object name and the flags
+    size_t fixedSize = 40 + hashSize + 2;
+
+    size_t offset = 12;
+
+    std::string path;
+    std::string conflicted; // the last path that was visited while in a conflict, which has an entry per side
+
+    GitIndexEntry entry;
+
+    for (uint32_t index = 0; index < count; index++)
+    {
+        if (offset + fixedSize > size)
+        {
+            return false;
+        }
+
+        const unsigned char* current = data + offset;
+
+        uint32_t mode     = ReadUInt32(current + 24);
+        uint32_t fileSize = ReadUInt32(current + 36);
+
+        uint16_t flags = ReadUInt16(current + 40 + hashSize);
+
+        const unsigned char* name = current + fixedSize;
+
+        bool skipWorktree = false;
+
+        if (flags & 0x4000)
+        {
+            if (version < 3 || name + 2 > end)
+            {
+                return false;
+            }
+
+            skipWorktree = (ReadUInt16(name) & 0x4000) != 0;
+
+            name += 2;
+        }
+
+        size_t strip = 0;
+
+        // version 4 paths only store what differs from the path before them
+        if (version == 4 && !ReadOffset(name, end, strip))
+        {
+            return false;
+        }
+
+        const unsigned char* terminator = static_cast<const unsigned char*>(std::memchr(name, '\0', end - name));
+
+        if (terminator == nullptr)
+        {
+            return false;
+        }
+
+        size_t nameLength = static_cast<size_t>(terminator - name);
+
+        if (version == 4)
+        {
+            if (strip > path.size())
+            {
+                return false;
+            }
+
+            path.resize(path.size() - strip);
+            path.append(reinterpret_cast<const char*>(name), nameLength);
+
+            offset = static_cast<size_t>(terminator - data) + 1;
+        }
+        else
+        {
+            if (visitor != nullptr)
+            {
+                path.assign(reinterpret_cast<const char*>(name), nameLength);
+            }
+
+            // earlier versions pad each entry with one to eight nulls to a multiple of eight bytes
+            size_t entrySize = static_cast<size_t>(name - current) + nameLength;
+
+            offset += (entrySize + 8) & ~static_cast<size_t>(7);
+        }
+
+        if (visitor == nullptr || skipWorktree || (mode & 0170000) != 0100000)
+        {
+            continue;
+        }
+
+        // a conflicted path has an entry for each side of the merge but only one file in the work tree
+        if (((flags >> 12) & 0x3) != 0)
+        {
+            if (path == conflicted)
+            {
+                continue;
+            }
+
+            conflicted = path;
+        }
+
+        entry.path       = path.c_str();
+        entry.pathLength = path.size();
+        entry.fileSize   = fileSize;
+        entry.mode       = mode;
+
+        (*visitor)(entry);
+    }
+
+    extensions = offset;
+
+    return offset <= size;
+}
+
+std::string Sonne::FindGitDirectory(const std::string& workTree)
+{
+    std::string dotGit = fmt::format("{}/.git", workTree);
+
+    Entry entry = GetFSEntry(dotGit);
+
+    if (!entry.isValid)
+    {
+        return "";
+    }
+
+    if (entry.isDirectory)
+    {
+        return dotGit;
+    }
+
+    // linked work trees and submodules have a file that points at the real git directory instead
+    std::ifstream in(dotGit);
+
+    std::string line;
+
+    std::getline(in, line);
+
+    if (line.compare(0, 7, "gitdir:") != 0)
+    {
+        return "";
+    }
+
+    std::string gitDirectory = TrimLine(line.substr(7));
+
+    bool absolute = !gitDirectory.empty() &&
+        (gitDirectory[0] == '/' || gitDirectory[0] == '\\' || (gitDirectory.size() > 1 && gitDirectory[1] == ':'));
+
+    return absolute ? gitDirectory : fmt::format("{}/{}", workTree, gitDirectory);
+}
+
+bool Sonne::ReadGitIndex(const std::string& gitDirectory, const std::function<void(const GitIndexEntry&)>& visitor)
+{
+    ReadBuffer buffer;
+
+    FileView view;
+
+    // the whole index is read in one go, or mapped when it is large
+    if (!view.Open(fmt::format("{}/index", gitDirectory), buffer))
+    {
+        return false;
+    }
+
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(view.GetData());
+
+    size_t hashSize = GetHashSize(gitDirectory);
+
+    if (view.GetSize() < 12 + hashSize || std::memcmp(data, "DIRC", 4) != 0)
+    {
+        return false;
+    }
+
+    uint32_t version = ReadUInt32(data + 4);
+
+    if (version < 2 || version > 4)
+    {
+        return false;
+    }
+
+    // the checksum at the end is not part of the entries or the extensions
+    size_t size = view.GetSize() - hashSize;
+
+    size_t extensions = 0;
+
+    // step over the entries once to find the extensions, so a split index is turned down before visiting anything
+    if (!ReadEntries(data, size, hashSize, extensions, nullptr))
+    {
+        return false;
+    }
+
+    while (extensions + 8 <= size)
+    {
+        // the rest of the entries of a split index live in a shared index file, which is not read here
+        if (std::memcmp(data + extensions, "link", 4) == 0)
+        {
+            return false;
+        }
+
+        extensions += 8 + ReadUInt32(data + extensions + 4);
+    }
+
+    return ReadEntries(data, size, hashSize, extensions, &visitor);
+}
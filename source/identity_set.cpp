@@ -0,0 +1,39 @@
+#include "sonne/pch.hpp"
+#include "sonne/identity_set.hpp"
+
+using namespace Sonne;
+
+constexpr size_t IdentitySet::ShardCount;
+
+bool IdentitySet::Insert(uint64_t device, uint64_t inode)
+{
+    // inodes handed out close together land in different shards, so a directory of new files spreads out
+    Shard& shard = m_shards[static_cast<size_t>((inode ^ device) % ShardCount)];
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    return shard.identities.insert(Identity { device, inode }).second;
+}
+
+void IdentitySet::Erase(uint64_t device, uint64_t inode)
+{
+    Shard& shard = m_shards[static_cast<size_t>((inode ^ device) % ShardCount)];
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    shard.identities.erase(Identity { device, inode });
+}
+
+size_t IdentitySet::GetSize() const
+{
+    size_t size = 0;
+
+    for (const Shard& shard : m_shards)
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        size += shard.identities.size();
+    }
+
+    return size;
+}
@@ -0,0 +1,500 @@
+#include "sonne/pch.hpp"
+#include "sonne/ignore.hpp"
+
+#include "sonne/file.hpp"
+
+using namespace Sonne;
+
+static inline bool IsSeparator(char character)
+{
+    return character == '/' || character == Separator;
+}
+
+/**
+ Compare plain pattern text to a path, where a `/` in the pattern matches the separator of the platform.
+ */
+static inline bool SameText(const char* pattern, const char* text, size_t length)
+{
+    for (size_t index = 0; index < length; index++)
+    {
+        if (pattern[index] != text[index] && !(pattern[index] == '/' && IsSeparator(text[index])))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ Match the single pattern element at `pattern` against a character, setting `next` to the element after it.
+ */
+static bool MatchCharacter(const char* pattern, const char* patternEnd, char character, const char*& next)
+{
+    unsigned char value = static_cast<unsigned char>(character);
+
+    if (*pattern == '?')
+    {
+        next = pattern + 1;
+
+        return !IsSeparator(character);
+    }
+
+    if (*pattern == '[')
+    {
+        const char* current = pattern + 1;
+
+        bool negate = false;
+
+        if (current < patternEnd && (*current == '!' || *current == '^'))
+        {
+            negate = true;
+
+            current++;
+        }
+
+        bool matched = false;
+
+        // a closing bracket right at the start is part of the class rather than the end of it
+        for (bool first = true; current < patternEnd && (*current != ']' || first); current++)
+        {
+            first = false;
+
+            if (*current == '\\' && current + 1 < patternEnd)
+            {
+                current++;
+            }
+
+            unsigned char low  = static_cast<unsigned char>(*current);
+            unsigned char high = low;
+
+            if (current + 2 < patternEnd && current[1] == '-' && current[2] != ']')
+            {
+                current += 2;
+
+                if (*current == '\\' && current + 1 < patternEnd)
+                {
+                    current++;
+                }
+
+                high = static_cast<unsigned char>(*current);
+            }
+
+            if (value >= low && value <= high)
+            {
+                matched = true;
+            }
+        }
+
+        // without a closing bracket the bracket is just a character
+        if (current >= patternEnd)
+        {
+            next = pattern + 1;
+
+            return character == '[';
+        }
+
+        next = current + 1;
+
+        return !IsSeparator(character) && matched != negate;
+    }
+
+    if (*pattern == '\\' && pattern + 1 < patternEnd)
+    {
+        next = pattern + 2;
+
+        return pattern[1] == character;
+    }
+
+    next = pattern + 1;
+
+    return (*pattern == '/') ? IsSeparator(character) : (*pattern == character);
+}
+
+/**
+ Match a whole glob against a whole piece of text.
+
+ A single star is matched by remembering where it started and retrying one character further on a mismatch, which
+ never crosses a separator. A double star tries the rest of the pattern at every point after it instead.
+ */
+static bool MatchGlob(const char* pattern, const char* patternEnd, const char* text, const char* textEnd)
+{
+    const char* starPattern = nullptr;
+    const char* starText    = nullptr;
+
+    while (true)
+    {
+        if (pattern < patternEnd && *pattern == '*')
+        {
+            if (pattern + 1 < patternEnd && pattern[1] == '*')
+            {
+                const char* rest = pattern + 2;
+
+                // `**/` can also match no directories at all, but only ever whole ones
+                bool wholeDirectories = (rest < patternEnd && *rest == '/');
+
+                if (wholeDirectories)
+                {
+                    rest++;
+                }
+
+                for (const char* start = text; start <= textEnd; start++)
+                {
+                    if (wholeDirectories && start != text && !IsSeparator(start[-1]))
+                    {
+                        continue;
+                    }
+
+                    if (MatchGlob(rest, patternEnd, start, textEnd))
+                    {
+                        return true;
+                    }
+                }
+
+                return false;
+            }
+
+            starPattern = ++pattern;
+            starText    = text;
+
+            continue;
+        }
+
+        if (text == textEnd)
+        {
+            if (pattern == patternEnd)
+            {
+                return true;
+            }
+        }
+        else if (pattern < patternEnd)
+        {
+            const char* next = nullptr;
+
+            if (MatchCharacter(pattern, patternEnd, *text, next))
+            {
+                pattern = next;
+
+                text++;
+
+                continue;
+            }
+        }
+
+        // let the last star take one more character and try again from there
+        if (starPattern != nullptr && starText < textEnd && !IsSeparator(*starText))
+        {
+            pattern = starPattern;
+            text    = ++starText;
+
+            continue;
+        }
+
+        return false;
+    }
+}
+
+void IgnoreMatcher::Add(const std::string& pattern)
+{
+    std::string line = pattern;
+
+    // trailing whitespace is dropped unless it is escaped
+    while (!line.empty() && (line.back() == ' ' || line.back() == '\t' || line.back() == '\r'))
+    {
+        if (line.back() != '\r' && line.size() > 1 && line[line.size() - 2] == '\\')
+        {
+            break;
+        }
+
+        line.pop_back();
+    }
+
+    if (line.empty() || line[0] == '#')
+    {
+        return;
+    }
+
+    Rule rule;
+
+    size_t start = 0;
+
+    if (line[0] == '!')
+    {
+        rule.negated = true;
+
+        start = 1;
+    }
+    else if (line[0] == '\\' && line.size() > 1 && (line[1] == '#' || line[1] == '!'))
+    {
+        start = 1; // an escaped comment or negation is matched literally
+    }
+
+    std::string body = line.substr(start);
+
+    while (!body.empty() && body.back() == '/')
+    {
+        rule.directoryOnly = true;
+
+        body.pop_back();
+    }
+
+    if (!body.empty() && body[0] == '/')
+    {
+        rule.anchored = true;
+
+        body.erase(0, 1);
+    }
+    else if (body.compare(0, 3, "**/") == 0 && body.find('/', 3) == std::string::npos)
+    {
+        body.erase(0, 3); // a leading `**/` before a plain name is the same as matching the name anywhere
+    }
+    else if (body.find('/') != std::string::npos)
+    {
+        rule.anchored = true;
+    }
+
+    if (body.empty())
+    {
+        return;
+    }
+
+    size_t special = body.find_first_of("*?[\\");
+
+    if (special == std::string::npos)
+    {
+        rule.kind = RuleKind::LITERAL;
+    }
+    else if (!rule.anchored && special == 0 && body[0] == '*' && body.find_first_of("*?[\\", 1) == std::string::npos)
+    {
+        rule.kind = RuleKind::SUFFIX;
+
+        body.erase(0, 1);
+    }
+    else
+    {
+        rule.kind = RuleKind::GLOB;
+    }
+
+    rule.pattern = std::move(body);
+
+    m_rules.push_back(std::move(rule));
+}
+
+bool IgnoreMatcher::AddFile(const std::string& path)
+{
+    std::ifstream in(path);
+
+    if (!in.good())
+    {
+        return false;
+    }
+
+    std::string line;
+
+    while (std::getline(in, line))
+    {
+        Add(line);
+    }
+
+    return true;
+}
+
+IgnoreResult IgnoreMatcher::Match(const char* path, size_t length, bool isDirectory) const
+{
+    size_t nameStart = length;
+
+    while (nameStart > 0 && !IsSeparator(path[nameStart - 1]))
+    {
+        nameStart--;
+    }
+
+    const char* name = path + nameStart;
+
+    size_t nameLength = length - nameStart;
+
+    // the last rule to match decides, so look from the end and stop at the first match
+    for (auto rule = m_rules.rbegin(); rule != m_rules.rend(); rule++)
+    {
+        if (rule->directoryOnly && !isDirectory)
+        {
+            continue;
+        }
+
+        const char* subject = rule->anchored ? path : name;
+
+        size_t subjectLength = rule->anchored ? length : nameLength;
+
+        const std::string& text = rule->pattern;
+
+        bool matched = false;
+
+        switch (rule->kind)
+        {
+        case RuleKind::LITERAL:
+            matched = (subjectLength == text.size() && SameText(text.data(), subject, subjectLength));
+            break;
+        case RuleKind::SUFFIX:
+            matched = (subjectLength >= text.size() &&
+                SameText(text.data(), subject + subjectLength - text.size(), text.size()));
+            break;
+        default:
+            matched = MatchGlob(text.data(), text.data() + text.size(), subject, subject + subjectLength);
+            break;
+        }
+
+        if (matched)
+        {
+            return rule->negated ? IgnoreResult::INCLUDED : IgnoreResult::IGNORED;
+        }
+    }
+
+    return IgnoreResult::NONE;
+}
+
+IgnoreResult IgnoreScope::Match(const std::string& fullPath, bool isDirectory) const
+{
+    for (const IgnoreScope* scope = this; scope != nullptr; scope = scope->parent.get())
+    {
+        if (fullPath.size() <= scope->baseLength)
+        {
+            continue;
+        }
+
+        IgnoreResult result = scope->matcher.Match(
+            fullPath.c_str() + scope->baseLength,
+            fullPath.size() - scope->baseLength,
+            isDirectory);
+
+        if (result != IgnoreResult::NONE)
+        {
+            return result;
+        }
+    }
+
+    return IgnoreResult::NONE;
+}
+
+static std::string Trim(const std::string& text)
+{
+    size_t start = text.find_first_not_of(" \t\r\n");
+
+    if (start == std::string::npos)
+    {
+        return "";
+    }
+
+    size_t end = text.find_last_not_of(" \t\r\n");
+
+    return text.substr(start, end - start + 1);
+}
+
+/**
+ Read `core.excludesFile` out of a git config file, returning a blank string if it is not set in that file.
+ */
+static std::string ReadExcludesFile(const std::string& path)
+{
+    std::ifstream in(path);
+
+    if (!in.good())
+    {
+        return "";
+    }
+
+    std::string excludes;
+
+    std::string line;
+
+    bool inCore = false;
+
+    while (std::getline(in, line))
+    {
+        line = Trim(line);
+
+        if (line.empty() || line[0] == '#' || line[0] == ';')
+        {
+            continue;
+        }
+
+        size_t equals = line.find('=');
+
+        // section and key names are not case sensitive in git configs, while the value is a path that is
+        std::string key = Trim(line.substr(0, equals));
+
+        std::transform(key.begin(), key.end(), key.begin(), [](char character) {
+            return (character >= 'A' && character <= 'Z') ? static_cast<char>(character - 'A' + 'a') : character;
+        });
+
+        if (key[0] == '[')
+        {
+            inCore = (key.compare(0, 6, "[core]") == 0);
+
+            continue;
+        }
+
+        if (!inCore || equals == std::string::npos || key != "excludesfile")
+        {
+            continue;
+        }
+
+        excludes = Trim(line.substr(equals + 1));
+
+        if (excludes.size() >= 2 && excludes.front() == '"' && excludes.back() == '"')
+        {
+            excludes = excludes.substr(1, excludes.size() - 2);
+        }
+    }
+
+    return excludes;
+}
+
+std::string Sonne::GetGlobalExcludesPath()
+{
+#ifdef _WIN32
+    const char* home = getenv("USERPROFILE");
+#else
+    const char* home = getenv("HOME");
+#endif
+
+    const char* configHome = getenv("XDG_CONFIG_HOME");
+
+    std::string gitHome = "";
+
+    if (configHome != nullptr && configHome[0] != '\0')
+    {
+        gitHome = fmt::format("{}/git", configHome);
+    }
+    else if (home != nullptr)
+    {
+        gitHome = fmt::format("{}/.config/git", home);
+    }
+
+    std::string excludes = "";
+
+    // git reads the config under the config home before the one in the home directory, so the latter wins
+    if (!gitHome.empty())
+    {
+        excludes = ReadExcludesFile(fmt::format("{}/config", gitHome));
+    }
+
+    if (home != nullptr)
+    {
+        std::string fromHome = ReadExcludesFile(fmt::format("{}/.gitconfig", home));
+
+        if (!fromHome.empty())
+        {
+            excludes = fromHome;
+        }
+    }
+
+    if (excludes.empty())
+    {
+        return gitHome.empty() ? "" : fmt::format("{}/ignore", gitHome);
+    }
+
+    if (excludes.compare(0, 2, "~/") == 0 && home != nullptr)
+    {
+        excludes = fmt::format("{}{}", home, excludes.substr(1));
+    }
+
+    return excludes;
+}
@@ -1,5 +1,7 @@
 #include "sonne/pch.hpp"
 
+#include <csignal>
+
 #include <cxxopts.hpp>
 
 #include "sonne/file.hpp"
@@ -7,6 +9,9 @@
 #include "sonne/config.hpp"
 #include "sonne/counter.hpp"
 #include "sonne/directory_counter.hpp"
+#include "sonne/server.hpp"
+#include "sonne/thread_pool.hpp"
+#include "sonne/watcher.hpp"
 
 size_t get_console_columns()
 {
@@ -59,8 +64,17 @@ void print_language_entry(Sonne::CountInfo& info, size_t columns)
     fmt::print("| {: <{}} |", info.language, cellWidth);
     fmt::print(" {: >{}} |", info.files, cellWidth);
     fmt::print(" {: >{}} |", info.emptyLines, cellWidth);
-    fmt::print(" {: >{}} |", info.codeLines, cellWidth);
-    fmt::print(" {: >{}} |", info.commentLines, cellWidth);
+    if (info.linesOnly)
+    {
+        // code and comment lines were never computed, so do not print them as zeroes
+        fmt::print(" {: >{}} |", "-", cellWidth);
+        fmt::print(" {: >{}} |", "-", cellWidth);
+    }
+    else
+    {
+        fmt::print(" {: >{}} |", info.codeLines, cellWidth);
+        fmt::print(" {: >{}} |", info.commentLines, cellWidth);
+    }
     fmt::print(" {: >{}} |\n", info.totalLines, cellWidth);
 }
 
@@ -72,6 +86,53 @@ void print_table_end(size_t columns)
     fmt::print("{:->{}}\n", "", ((cellWidth + 4) * 6) - 5);
 }
 
+// set from a signal handler to stop serving, which lets the server remove its socket on the way out
+volatile std::sig_atomic_t stopServing = 0;
+
+void handle_stop(int)
+{
+    stopServing = 1;
+}
+
+/**
+ Read a count back out of an answer from the server.
+ */
+Sonne::CountInfo count_from_json(const nlohmann::json& countObject)
+{
+    Sonne::CountInfo count;
+
+    count.language     = countObject.value("language", "");
+    count.files        = countObject.value("files", static_cast<size_t>(0));
+    count.totalLines   = countObject.value("total", static_cast<size_t>(0));
+    count.emptyLines   = countObject.value("empty", static_cast<size_t>(0));
+    count.codeLines    = countObject.value("code", static_cast<size_t>(0));
+    count.commentLines = countObject.value("comment", static_cast<size_t>(0));
+    count.linesOnly    = countObject.value("linesOnly", false);
+
+    return count;
+}
+
+void print_directory_totals(const Sonne::DirectoryInfo& info, size_t columns)
+{
+    for (auto& language : info.totals)
+    {
+        if (language.second.language == "Totals")
+        {
+            continue; // print totals at the end of the info separate from other langs
+        }
+
+        Sonne::CountInfo entry = language.second; // printing may truncate the name, so print from a copy
+
+        print_language_entry(entry, columns);
+    }
+
+    print_table_end(columns);
+
+    Sonne::CountInfo totals = info.totals.at("Totals");
+
+    print_language_entry(totals, columns);
+}
+
 int main(int argc, char** argv)
 {
     fmt::print("\n"); // print a new line to separate from the command input
@@ -87,6 +148,18 @@ int main(int argc, char** argv)
         ("h,help", "Print help for the program")
         ("i,ignore-hidden", "Determines whether hidden files/directories should be skipped over")
         ("c,columns", "Amount of columns to base print off of", cxxopts::value<size_t>())
+        ("j,jobs", "Amount of worker threads to count with, defaults to the available cpus", cxxopts::value<size_t>())
+        ("l,lines-only", "Only count total and empty lines, skipping comment and string parsing")
+        ("no-git-ignore", "Count files even if a .gitignore or the excludes of git would skip them")
+        ("git-index", "Count the files tracked by git from its index instead of walking the directory")
+        ("follow-symlinks", "Walk into links to directories, counting each file only once however it is reached")
+        ("dedupe", "Reuse the count of a file for every other file with the same contents")
+        ("cache", "File to keep counts in between runs to skip unchanged files", cxxopts::value<std::string>())
+        ("watch", "Keep running after the count, counting files again as they change and printing new totals")
+        ("daemon", "Serve the counts of the input directory on a socket at this path", cxxopts::value<std::string>())
+        ("query", "Ask the server at this socket path for the counts of the input", cxxopts::value<std::string>())
+        ("files-from", "Count the files listed in this file or - for stdin, split by NULs or lines",
+            cxxopts::value<std::string>())
         ("input", "Input path for the program", cxxopts::value<std::string>())
         ("positional", "Positional parameters for counting paths", cxxopts::value<std::vector<std::string>>(positional));
 
@@ -145,6 +218,18 @@ int main(int argc, char** argv)
         config->SetColumns(result["columns"].as<size_t>());
     }
 
+    // parse the amount of counting threads from the command line if specified
+    if (result.count("j"))
+    {
+        config->SetJobs(result["jobs"].as<size_t>());
+    }
+
+    // skip the language parsing entirely if only line counts are needed
+    if (result.count("l"))
+    {
+        config->SetLinesOnly(true);
+    }
+
     size_t columns = config->GetColumns();
 
     fmt::print("{: ^{}}\n", "Sonne 2.2.0", columns);
@@ -156,43 +241,247 @@ int main(int argc, char** argv)
         config->SetIgnoreHidden(result["s"].as<bool>());
     }
 
-    if (result.count("input"))
+    if (result.count("no-git-ignore"))
+    {
+        config->SetGitIgnore(false);
+    }
+
+    if (result.count("dedupe"))
+    {
+        config->SetDedupe(true);
+    }
+
+    if (result.count("cache"))
+    {
+        config->SetCachePath(result["cache"].as<std::string>());
+    }
+
+    if (result.count("follow-symlinks"))
+    {
+        config->SetFollowSymlinks(true);
+    }
+
+    if (result.count("git-index"))
+    {
+        config->SetUseGitIndex(true);
+    }
+
+    if (result.count("files-from"))
+    {
+        std::string listPath = result["files-from"].as<std::string>();
+
+        bool fromInput = (listPath == "-");
+
+        std::ifstream file;
+
+        if (fromInput)
+        {
+            // nothing else reads standard input, so it can buffer on its own and hand over paths as soon as they arrive
+            std::ios::sync_with_stdio(false);
+        }
+        else
+        {
+            file.open(listPath, std::ios::binary);
+
+            if (!file.good())
+            {
+                Fatal(fmt::format("Failed to open the list of files at: {}", listPath));
+            }
+        }
+
+        std::istream& list = fromInput ? std::cin : file;
+
+        std::string title = fromInput ? "Files from standard input" : fmt::format("Files from {}", listPath);
+
+        fmt::print("{: ^{}}\n\n", title, columns);
+
+        print_info_header(columns);
+
+        // relative paths in the list are taken from the current directory, which the config is looked for in as well
+        Sonne::DirectoryCounter counter(".", config);
+
+        Sonne::DirectoryInfo info = counter.RunFromList(list);
+
+        print_directory_totals(info, columns);
+
+        print_table_end(columns);
+
+        fmt::print("\n{: ^{}}\n", fmt::format("Counted {} of {} listed files",
+            info.totals.at("Totals").files,
+            info.listedFiles), columns);
+    }
+    else if (result.count("input"))
     {
         std::string input = result["input"].as<std::string>();
 
         Sonne::Entry entry = Sonne::GetFSEntry(input);
 
-        if (entry.isValid)
+        if (result.count("query"))
+        {
+            // the server keeps counts by full path, so a path that no longer exists is still sent in full
+            std::string path = entry.isValid ? entry.fullPath : input;
+
+            nlohmann::json request;
+
+            request["query"] = (entry.isValid && !entry.isDirectory) ? "file" : "languages";
+            request["path"]  = path;
+
+            std::string response;
+
+            if (!Sonne::Server::Query(result["query"].as<std::string>(), request.dump(), response))
+            {
+                Fatal(fmt::format("No server is listening at: {}", result["query"].as<std::string>()));
+            }
+
+            nlohmann::json answer = nlohmann::json::parse(response, nullptr, false);
+
+            if (answer.is_discarded() || !answer.value("ok", false))
+            {
+                Fatal(answer.is_discarded() ? "The server sent an answer that is not JSON" : answer.value("error", ""));
+            }
+
+            fmt::print("{: ^{}}\n\n", path, columns);
+
+            print_info_header(columns);
+
+            if (answer.contains("file"))
+            {
+                Sonne::CountInfo count = count_from_json(answer["file"]);
+
+                print_language_entry(count, columns);
+            }
+            else
+            {
+                Sonne::DirectoryInfo info;
+
+                for (auto& language : answer["languages"])
+                {
+                    info.Add(count_from_json(language));
+                }
+
+                info.totals["Totals"] = count_from_json(answer["totals"]);
+
+                print_directory_totals(info, columns);
+            }
+
+            print_table_end(columns);
+        }
+        else if (result.count("daemon"))
+        {
+            if (!Sonne::Server::IsSupported())
+            {
+                Fatal("Serving counts is only supported on platforms with unix sockets!");
+            }
+
+            if (!entry.isDirectory)
+            {
+                Fatal("Path to serve counts from must be directory!");
+            }
+
+            std::string socketPath = result["daemon"].as<std::string>();
+
+            Sonne::Server server(socketPath, entry.fullPath, config);
+
+            if (!server.Start())
+            {
+                Fatal(fmt::format("Failed to serve counts at: {}", socketPath));
+            }
+
+            std::signal(SIGINT, handle_stop);
+            std::signal(SIGTERM, handle_stop);
+
+            fmt::print("{: ^{}}\n", fmt::format("Serving the counts of {} files in {} at {}",
+                server.GetWatcher().GetFileCount(),
+                entry.fullPath,
+                socketPath), columns);
+
+            while (!stopServing)
+            {
+                server.Serve(-1);
+            }
+        }
+        else if (entry.isValid)
         {
             fmt::print("{: ^{}}\n\n", entry.fullPath, columns);
 
             print_info_header(columns);
 
+            std::vector<std::string> summary; // lines of extra details about the run printed below the table
+
+            // only set when watching, which keeps the counts of the first run around to update as files change
+            std::unique_ptr<Sonne::Watcher> watcher = nullptr;
+
             if (entry.isDirectory)
             {
-                Sonne::DirectoryCounter counter(entry.fullPath, config);
-
-                Sonne::DirectoryInfo info = counter.Run();
+                Sonne::DirectoryInfo info;
 
-                for (auto& language : info.totals)
+                if (result.count("watch"))
                 {
-                    if (language.second.language == "Totals")
+                    if (!Sonne::Watcher::IsSupported())
                     {
-                        continue; // print totals at the end of the info separate from other langs
+                        Fatal("Watching for changes is only supported on linux!");
                     }
 
-                    print_language_entry(language.second, columns);
+                    watcher.reset(new Sonne::Watcher(entry.fullPath, config));
+
+                    info = watcher->Start();
+                }
+                else
+                {
+                    Sonne::DirectoryCounter counter(entry.fullPath, config);
+
+                    info = counter.Run();
+                }
+
+                print_directory_totals(info, columns);
+
+                if (info.fromGitIndex)
+                {
+                    summary.push_back(fmt::format("Listed {} tracked entries from the git index in {} KiB",
+                        info.walkedEntries,
+                        info.walkMemory / 1024));
+                }
+                else if (info.walkedEntries > 0)
+                {
+                    summary.push_back(fmt::format("Walked {} entries in {} KiB ({} bytes per entry)",
+                        info.walkedEntries,
+                        info.walkMemory / 1024,
+                        info.walkMemory / info.walkedEntries));
+
+                    size_t files = std::max<size_t>(info.totals.at("Totals").files, 1);
+
+                    summary.push_back(fmt::format("{:.2f} filesystem calls per file to walk",
+                        static_cast<double>(info.walkSyscalls) / files));
                 }
 
-                print_table_end(columns);
+                if (info.usedCache)
+                {
+                    summary.push_back(fmt::format("Reused {} of {} counts from the cache",
+                        info.cacheHits,
+                        info.totals.at("Totals").files));
+                }
+
+                if (info.dedupedFiles > 0)
+                {
+                    summary.push_back(fmt::format("Reused counts for {} identical files, skipping {} KiB",
+                        info.dedupedFiles,
+                        info.dedupedBytes / 1024));
+                }
 
-                print_language_entry(info.totals.at("Totals"), columns);
+                if (info.duplicates > 0)
+                {
+                    summary.push_back(fmt::format("Skipped {} files and directories that were already counted",
+                        info.duplicates));
+                }
             }
             else
             {
                 Sonne::Counter counter(entry.fullPath);
 
-                Sonne::CountInfo info = counter.Count(config);
+                // a pool is still used for a single file, as large files are split up across the workers
+                Sonne::ThreadPool pool(config->GetJobs());
+
+                Sonne::CountInfo info = counter.Count(config, &pool);
 
                 print_language_entry(info, columns);
 
@@ -204,6 +493,48 @@ int main(int argc, char** argv)
             }
 
             print_table_end(columns);
+
+            if (!summary.empty())
+            {
+                fmt::print("\n");
+            }
+
+            for (auto& line : summary)
+            {
+                fmt::print("{: ^{}}\n", line, columns);
+            }
+
+            if (watcher != nullptr)
+            {
+                fmt::print("\n{: ^{}}\n", fmt::format("Watching {} directories for changes", watcher->GetWatchCount()),
+                    columns);
+
+                while (true)
+                {
+                    // the descriptor is gone if watching failed to start, which would otherwise never wait on anything
+                    if (watcher->GetDescriptor() < 0)
+                    {
+                        Fatal("Failed to watch the directory for changes!");
+                    }
+
+                    if (!watcher->Update(-1))
+                    {
+                        continue;
+                    }
+
+                    fmt::print("\n");
+
+                    print_info_header(columns);
+
+                    print_directory_totals(watcher->GetInfo(), columns);
+
+                    print_table_end(columns);
+
+                    fmt::print("\n{: ^{}}\n", fmt::format("Counted {} changes in {:.2f} ms",
+                        watcher->GetChangedFiles(),
+                        static_cast<double>(watcher->GetUpdateTime()) / 1000.0), columns);
+                }
+            }
         }
         else
         {
@@ -0,0 +1,270 @@
+#include "sonne/pch.hpp"
+#include "sonne/scan.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE2__))
+#define SONNE_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+using namespace Sonne;
+
+typedef size_t (*ScanFunction)(const char*, size_t, size_t, const ScanSet&, size_t&);
+
+static inline size_t CountBits(uint32_t value)
+{
+#if defined(_MSC_VER)
+    return static_cast<size_t>(__popcnt(value));
+#else
+    return static_cast<size_t>(__builtin_popcount(value));
+#endif
+}
+
+static inline size_t LowestBit(uint32_t value)
+{
+#if defined(_MSC_VER)
+    unsigned long index = 0;
+
+    _BitScanForward(&index, value);
+
+    return static_cast<size_t>(index);
+#else
+    return static_cast<size_t>(__builtin_ctz(value));
+#endif
+}
+
+static size_t ScanScalar(const char* data, size_t start, size_t end, const ScanSet& stops, size_t& nonBlank)
+{
+    for (size_t index = start; index < end; index++)
+    {
+        char current = data[index];
+
+        if (stops.Contains(current))
+        {
+            return index;
+        }
+
+        if (current != ' ' && current != '\t')
+        {
+            nonBlank++;
+        }
+    }
+
+    return end;
+}
+
+#ifdef SONNE_SCAN_X86
+static size_t ScanSSE2(const char* data, size_t start, size_t end, const ScanSet& stops, size_t& nonBlank)
+{
+    __m128i needles[ScanSet::MaxBytes];
+
+    for (size_t index = 0; index < stops.count; index++)
+    {
+        needles[index] = _mm_set1_epi8(static_cast<char>(stops.bytes[index]));
+    }
+
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i tab   = _mm_set1_epi8('\t');
+
+    size_t index = start;
+
+    for (; index + 16 <= end; index += 16)
+    {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + index));
+
+        __m128i hits = _mm_setzero_si128();
+
+        for (size_t needle = 0; needle < stops.count; needle++)
+        {
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, needles[needle]));
+        }
+
+        uint32_t stopMask  = static_cast<uint32_t>(_mm_movemask_epi8(hits));
+        uint32_t blankMask = static_cast<uint32_t>(_mm_movemask_epi8(
+            _mm_or_si128(_mm_cmpeq_epi8(block, space), _mm_cmpeq_epi8(block, tab))));
+
+        if (stopMask != 0)
+        {
+            size_t offset = LowestBit(stopMask);
+
+            // only count the non blank bytes that come before the stop byte
+            nonBlank += offset - CountBits(blankMask & ((1u << offset) - 1u));
+
+            return index + offset;
+        }
+
+        nonBlank += 16 - CountBits(blankMask);
+    }
+
+    return ScanScalar(data, index, end, stops, nonBlank);
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+__attribute__((target("avx2")))
+#endif
+static size_t ScanAVX2(const char* data, size_t start, size_t end, const ScanSet& stops, size_t& nonBlank)
+{
+    __m256i needles[ScanSet::MaxBytes];
+
+    for (size_t index = 0; index < stops.count; index++)
+    {
+        needles[index] = _mm256_set1_epi8(static_cast<char>(stops.bytes[index]));
+    }
+
+    const __m256i space = _mm256_set1_epi8(' ');
+    const __m256i tab   = _mm256_set1_epi8('\t');
+
+    size_t index = start;
+
+    for (; index + 32 <= end; index += 32)
+    {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + index));
+
+        __m256i hits = _mm256_setzero_si256();
+
+        for (size_t needle = 0; needle < stops.count; needle++)
+        {
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, needles[needle]));
+        }
+
+        uint32_t stopMask  = static_cast<uint32_t>(_mm256_movemask_epi8(hits));
+        uint32_t blankMask = static_cast<uint32_t>(_mm256_movemask_epi8(
+            _mm256_or_si256(_mm256_cmpeq_epi8(block, space), _mm256_cmpeq_epi8(block, tab))));
+
+        if (stopMask != 0)
+        {
+            size_t offset = LowestBit(stopMask);
+
+            uint32_t before = (offset == 0) ? 0u : (blankMask & (0xFFFFFFFFu >> (32 - offset)));
+
+            nonBlank += offset - CountBits(before);
+
+            return index + offset;
+        }
+
+        nonBlank += 32 - CountBits(blankMask);
+    }
+
+    // finish off anything smaller than a full avx block with the narrower kernel
+    return ScanSSE2(data, index, end, stops, nonBlank);
+}
+
+static bool HasAVX2()
+{
+#if defined(_MSC_VER)
+    int info[4] = {};
+
+    __cpuidex(info, 7, 0);
+
+    bool avx2 = (info[1] & (1 << 5)) != 0;
+
+    __cpuid(info, 1);
+
+    // the os also has to save the ymm registers, which is signaled by osxsave and the xcr0 register
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+
+    return avx2 && osxsave && ((_xgetbv(0) & 0x6) == 0x6);
+#else
+    __builtin_cpu_init();
+
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+static ScanFunction SelectKernel(const char*& name)
+{
+#ifdef SONNE_SCAN_X86
+    if (HasAVX2())
+    {
+        name = "avx2";
+
+        return &ScanAVX2;
+    }
+
+    name = "sse2";
+
+    return &ScanSSE2;
+#else
+    name = "scalar";
+
+    return &ScanScalar;
+#endif
+}
+
+struct KernelChoice
+{
+
+    const char* name = "";
+
+    ScanFunction kernel = nullptr;
+
+    KernelChoice()
+    {
+        kernel = SelectKernel(name);
+    }
+
+};
+
+static const KernelChoice& GetKernelChoice()
+{
+    static const KernelChoice choice; // picked once per process, initialization is thread safe
+
+    return choice;
+}
+
+size_t Sonne::ScanToStop(const char* data, size_t start, size_t end, const ScanSet& stops, size_t& nonBlank)
+{
+    return GetKernelChoice().kernel(data, start, end, stops, nonBlank);
+}
+
+const char* Sonne::GetScanKernelName()
+{
+    return GetKernelChoice().name;
+}
+
+bool Sonne::IsScanKernelSupported(ScanKernel kernel)
+{
+    switch (kernel)
+    {
+#ifdef SONNE_SCAN_X86
+    case ScanKernel::AVX2:
+        return HasAVX2();
+    case ScanKernel::SSE2:
+        return true;
+#endif
+    case ScanKernel::SCALAR:
+        return true;
+    default:
+        return false;
+    }
+}
+
+size_t Sonne::ScanToStopWith(
+    ScanKernel kernel,
+    const char* data,
+    size_t start,
+    size_t end,
+    const ScanSet& stops,
+    size_t& nonBlank)
+{
+    if (!IsScanKernelSupported(kernel))
+    {
+        kernel = ScanKernel::SCALAR;
+    }
+
+    switch (kernel)
+    {
+#ifdef SONNE_SCAN_X86
+    case ScanKernel::AVX2:
+        return ScanAVX2(data, start, end, stops, nonBlank);
+    case ScanKernel::SSE2:
+        return ScanSSE2(data, start, end, stops, nonBlank);
+#endif
+    default:
+        return ScanScalar(data, start, end, stops, nonBlank);
+    }
+}
\ No newline at end of file
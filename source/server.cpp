@@ -0,0 +1,569 @@
+#include "sonne/pch.hpp"
+#include "sonne/server.hpp"
+
+#include "sonne/config.hpp"
+#include "sonne/file.hpp"
+
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+using namespace Sonne;
+
+constexpr size_t Server::MaxFrame;
+
+#ifdef MSG_NOSIGNAL
+static constexpr int SendFlags = MSG_NOSIGNAL; // a client that hung up is closed rather than killing the server
+#else
+static constexpr int SendFlags = 0;
+#endif
+
+/**
+ Add a message to the end of a buffer, after the length that frames it.
+ */
+static void AppendFrame(std::string& buffer, const std::string& message)
+{
+    uint32_t length = static_cast<uint32_t>(message.size());
+
+    char header[4] = {
+        static_cast<char>((length >> 24) & 0xFF),
+        static_cast<char>((length >> 16) & 0xFF),
+        static_cast<char>((length >> 8) & 0xFF),
+        static_cast<char>(length & 0xFF)
+    };
+
+    buffer.append(header, sizeof(header));
+    buffer.append(message);
+}
+
+static uint32_t ReadLength(const char* data)
+{
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+
+    return (static_cast<uint32_t>(bytes[0]) << 24) |
+        (static_cast<uint32_t>(bytes[1]) << 16) |
+        (static_cast<uint32_t>(bytes[2]) << 8) |
+        static_cast<uint32_t>(bytes[3]);
+}
+
+static nlohmann::json CountToJSON(const CountInfo& count)
+{
+    nlohmann::json countObject;
+
+    countObject["language"] = count.language;
+    countObject["files"]    = count.files;
+    countObject["total"]    = count.totalLines;
+    countObject["empty"]    = count.emptyLines;
+    countObject["code"]     = count.codeLines;
+    countObject["comment"]  = count.commentLines;
+
+    countObject["linesOnly"] = count.linesOnly;
+
+    return countObject;
+}
+
+#ifndef _WIN32
+/**
+ Fill in the address of a socket path, returning false if the path is too long to fit.
+ */
+static bool MakeAddress(const std::string& socketPath, struct sockaddr_un& address)
+{
+    std::memset(&address, 0, sizeof(address));
+
+    address.sun_family = AF_UNIX;
+
+    if (socketPath.empty() || socketPath.size() >= sizeof(address.sun_path))
+    {
+        return false;
+    }
+
+    std::memcpy(address.sun_path, socketPath.c_str(), socketPath.size());
+
+    return true;
+}
+#endif
+
+Server::Server(const std::string& socketPath, const std::string& path, std::shared_ptr<Config> config)
+    :
+    m_socketPath(socketPath),
+    m_watcher(path, config)
+{
+}
+
+Server::~Server()
+{
+#ifndef _WIN32
+    for (Client& client : m_clients)
+    {
+        close(client.socket);
+    }
+
+    if (m_socket >= 0)
+    {
+        close(m_socket);
+
+        unlink(m_socketPath.c_str());
+    }
+#endif
+}
+
+bool Server::IsSupported()
+{
+#ifndef _WIN32
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool Server::Start()
+{
+#ifndef _WIN32
+    struct sockaddr_un address;
+
+    if (!MakeAddress(m_socketPath, address))
+    {
+        fmt::print("The socket path is too long: {}\n", m_socketPath);
+
+        return false;
+    }
+
+    // a socket left behind by a server that is gone is replaced, but one that still takes connections is not
+    int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    bool listening = (probe >= 0 && connect(probe, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) == 0);
+
+    if (probe >= 0)
+    {
+        close(probe);
+    }
+
+    if (listening)
+    {
+        fmt::print("A server is already listening at: {}\n", m_socketPath);
+
+        return false;
+    }
+
+    struct stat existing;
+
+    if (lstat(m_socketPath.c_str(), &existing) == 0)
+    {
+        if (!S_ISSOCK(existing.st_mode))
+        {
+            fmt::print("Something other than a socket is already at: {}\n", m_socketPath);
+
+            return false;
+        }
+
+        unlink(m_socketPath.c_str());
+    }
+
+    m_socket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (m_socket < 0)
+    {
+        return false;
+    }
+
+    fcntl(m_socket, F_SETFD, FD_CLOEXEC);
+    fcntl(m_socket, F_SETFL, O_NONBLOCK);
+
+    if (bind(m_socket, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0 || listen(m_socket, 64) != 0)
+    {
+        fmt::print("Failed to listen at {}: {}\n", m_socketPath, strerror(errno));
+
+        close(m_socket);
+
+        m_socket = -1;
+
+        return false;
+    }
+
+    // the count is only started once the socket is taken, so two servers never both count the same tree for nothing
+    m_watcher.Start();
+
+    return true;
+#else
+    return false;
+#endif
+}
+
+void Server::Serve(int timeout)
+{
+#ifndef _WIN32
+    if (m_socket < 0)
+    {
+        return;
+    }
+
+    std::vector<struct pollfd> descriptors;
+
+    descriptors.reserve(m_clients.size() + 2);
+
+    descriptors.push_back(pollfd { m_socket, POLLIN, 0 });
+    descriptors.push_back(pollfd { m_watcher.GetDescriptor(), POLLIN, 0 }); // skipped by poll when it is -1
+
+    for (const Client& client : m_clients)
+    {
+        short events = client.output.empty() ? POLLIN : static_cast<short>(POLLIN | POLLOUT);
+
+        descriptors.push_back(pollfd { client.socket, events, 0 });
+    }
+
+    if (poll(descriptors.data(), descriptors.size(), timeout) <= 0)
+    {
+        return;
+    }
+
+    // clients are looked at before any are added or removed, so each one still lines up with its descriptor
+    std::vector<Client> kept;
+
+    kept.reserve(m_clients.size());
+
+    for (size_t index = 0; index < m_clients.size(); index++)
+    {
+        Client& client = m_clients[index];
+
+        short events = descriptors[index + 2].revents;
+
+        bool open = true;
+
+        if (events & (POLLIN | POLLHUP | POLLERR))
+        {
+            open = _Receive(client);
+        }
+
+        if (open && !client.output.empty())
+        {
+            open = _Send(client);
+        }
+
+        if (open)
+        {
+            kept.push_back(std::move(client));
+        }
+        else
+        {
+            close(client.socket);
+        }
+    }
+
+    m_clients = std::move(kept);
+
+    if (descriptors[1].revents & POLLIN)
+    {
+        m_watcher.Update(0);
+    }
+
+    if (descriptors[0].revents & POLLIN)
+    {
+        int accepted = -1;
+
+        while ((accepted = accept(m_socket, nullptr, nullptr)) >= 0)
+        {
+            fcntl(accepted, F_SETFD, FD_CLOEXEC);
+            fcntl(accepted, F_SETFL, O_NONBLOCK);
+
+#if defined(SO_NOSIGPIPE) && !defined(MSG_NOSIGNAL)
+            int enabled = 1;
+
+            setsockopt(accepted, SOL_SOCKET, SO_NOSIGPIPE, &enabled, sizeof(enabled));
+#endif
+
+            m_clients.push_back(Client { accepted, "", "" });
+        }
+    }
+#else
+    (void)timeout;
+#endif
+}
+
+std::string Server::Answer(const std::string& request) const
+{
+    nlohmann::json answer;
+
+    answer["ok"] = false;
+
+    nlohmann::json parsed = nlohmann::json::parse(request, nullptr, false);
+
+    if (parsed.is_discarded() || !parsed.is_object())
+    {
+        answer["error"] = "The request is not a JSON object";
+
+        return answer.dump();
+    }
+
+    // a field of the wrong type is answered as an error rather than thrown out of the server
+    for (const char* field : { "query", "path" })
+    {
+        if (parsed.contains(field) && !parsed[field].is_string())
+        {
+            answer["error"] = fmt::format("The {} of a request has to be a string", field);
+
+            return answer.dump();
+        }
+    }
+
+    std::string query = parsed.value("query", "");
+
+    std::string path = _Resolve(parsed.value("path", ""));
+
+    if (query == "file")
+    {
+        CountInfo count;
+
+        if (!m_watcher.GetFile(path, count))
+        {
+            answer["error"] = fmt::format("No file is counted at: {}", path);
+
+            return answer.dump();
+        }
+
+        answer["file"] = CountToJSON(count);
+    }
+    else if (query == "totals" || query == "languages")
+    {
+        DirectoryInfo info;
+
+        // a path with nothing counted below it is still a valid path to ask about, it just has nothing in it
+        if (!m_watcher.GetTotals(path, info))
+        {
+            CountInfo empty = {};
+
+            empty.language = "Totals";
+            empty.files    = 0;
+
+            info.totals.insert(std::make_pair("Totals", empty));
+        }
+
+        answer["totals"] = CountToJSON(info.totals.at("Totals"));
+
+        if (query == "languages")
+        {
+            nlohmann::json languages = nlohmann::json::array();
+
+            for (auto& language : info.totals)
+            {
+                if (language.first != "Totals")
+                {
+                    languages.push_back(CountToJSON(language.second));
+                }
+            }
+
+            answer["languages"] = languages;
+        }
+    }
+    else
+    {
+        answer["error"] = fmt::format("Unknown query: {}", query);
+
+        return answer.dump();
+    }
+
+    answer["ok"]   = true;
+    answer["path"] = path;
+
+    return answer.dump();
+}
+
+bool Server::Query(const std::string& socketPath, const std::string& request, std::string& response)
+{
+#ifndef _WIN32
+    struct sockaddr_un address;
+
+    if (!MakeAddress(socketPath, address))
+    {
+        return false;
+    }
+
+    int connection = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (connection < 0)
+    {
+        return false;
+    }
+
+#if defined(SO_NOSIGPIPE) && !defined(MSG_NOSIGNAL)
+    int enabled = 1;
+
+    setsockopt(connection, SOL_SOCKET, SO_NOSIGPIPE, &enabled, sizeof(enabled));
+#endif
+
+    if (connect(connection, reinterpret_cast<struct sockaddr*>(&address), sizeof(address)) != 0)
+    {
+        close(connection);
+
+        return false;
+    }
+
+    std::string output;
+
+    AppendFrame(output, request);
+
+    size_t sent = 0;
+
+    while (sent < output.size())
+    {
+        ssize_t written = send(connection, output.data() + sent, output.size() - sent, SendFlags);
+
+        if (written <= 0)
+        {
+            close(connection);
+
+            return false;
+        }
+
+        sent += static_cast<size_t>(written);
+    }
+
+    std::string input;
+
+    char buffer[16 * 1024];
+
+    // read until the whole frame of the answer is in
+    while (input.size() < 4 || input.size() < 4 + static_cast<size_t>(ReadLength(input.data())))
+    {
+        ssize_t received = recv(connection, buffer, sizeof(buffer), 0);
+
+        if (received <= 0)
+        {
+            close(connection);
+
+            return false;
+        }
+
+        input.append(buffer, static_cast<size_t>(received));
+    }
+
+    close(connection);
+
+    response = input.substr(4, ReadLength(input.data()));
+
+    return true;
+#else
+    (void)socketPath;
+    (void)request;
+    (void)response;
+
+    return false;
+#endif
+}
+
+bool Server::_Receive(Client& client)
+{
+#ifndef _WIN32
+    char buffer[16 * 1024];
+
+    while (true)
+    {
+        ssize_t received = recv(client.socket, buffer, sizeof(buffer), 0);
+
+        if (received == 0)
+        {
+            return false; // the client hung up
+        }
+
+        if (received < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                return false;
+            }
+
+            break;
+        }
+
+        client.input.append(buffer, static_cast<size_t>(received));
+    }
+
+    size_t offset = 0;
+
+    while (client.input.size() - offset >= 4)
+    {
+        size_t length = ReadLength(client.input.data() + offset);
+
+        if (length > MaxFrame)
+        {
+            return false;
+        }
+
+        if (client.input.size() - offset < 4 + length)
+        {
+            break;
+        }
+
+        AppendFrame(client.output, Answer(client.input.substr(offset + 4, length)));
+
+        offset += 4 + length;
+    }
+
+    client.input.erase(0, offset);
+
+    return true;
+#else
+    (void)client;
+
+    return false;
+#endif
+}
+
+bool Server::_Send(Client& client)
+{
+#ifndef _WIN32
+    while (!client.output.empty())
+    {
+        ssize_t written = send(client.socket, client.output.data(), client.output.size(), SendFlags);
+
+        if (written < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            // the rest is sent once the client has read enough to make room
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+
+        client.output.erase(0, static_cast<size_t>(written));
+    }
+
+    return true;
+#else
+    (void)client;
+
+    return false;
+#endif
+}
+
+std::string Server::_Resolve(const std::string& path) const
+{
+    const std::string& root = m_watcher.GetPath();
+
+    std::string resolved = path;
+
+    bool absolute = !resolved.empty() &&
+        (resolved[0] == '/' || resolved[0] == '\\' || (resolved.size() > 1 && resolved[1] == ':'));
+
+    if (!absolute)
+    {
+        resolved = (resolved.empty() || resolved == ".") ? root : fmt::format("{}{}{}", root, Separator, resolved);
+    }
+
+    std::replace(resolved.begin(), resolved.end(), '/', Separator);
+
+    while (resolved.size() > root.size() && resolved.back() == Separator)
+    {
+        resolved.pop_back();
+    }
+
+    return resolved;
+}
@@ -0,0 +1,255 @@
+#include "sonne/pch.hpp"
+#include "sonne/thread_pool.hpp"
+
+using namespace Sonne;
+
+#ifdef __linux__
+/**
+ Read the cpu quota for the cgroup the process is in, returning zero if there is no quota set.
+
+ Handles both the unified (v2) hierarchy through `cpu.max` and the legacy (v1) cfs quota and period files.
+ */
+static size_t GetCgroupCpuLimit()
+{
+    std::string cgroupPath = "";
+
+    std::ifstream cgroupFile("/proc/self/cgroup");
+
+    std::string line;
+
+    // the unified hierarchy is listed as `0::<path>` in the cgroup file for the process
+    while (std::getline(cgroupFile, line))
+    {
+        if (line.compare(0, 3, "0::") == 0)
+        {
+            cgroupPath = line.substr(3);
+
+            break;
+        }
+    }
+
+    std::vector<std::string> candidates = {
+        fmt::format("/sys/fs/cgroup{}/cpu.max", cgroupPath),
+        "/sys/fs/cgroup/cpu.max"
+    };
+
+    for (auto& candidate : candidates)
+    {
+        std::ifstream in(candidate);
+
+        std::string quota;
+
+        double period = 0.0;
+
+        if (!(in >> quota >> period))
+        {
+            continue;
+        }
+
+        if (quota == "max" || period <= 0.0)
+        {
+            return 0; // no limit set for this cgroup
+        }
+
+        return static_cast<size_t>(std::ceil(std::stod(quota) / period));
+    }
+
+    std::ifstream quotaIn("/sys/fs/cgroup/cpu/cpu.cfs_quota_us");
+    std::ifstream periodIn("/sys/fs/cgroup/cpu/cpu.cfs_period_us");
+
+    long long quota  = -1;
+    long long period = 0;
+
+    if ((quotaIn >> quota) && (periodIn >> period) && quota > 0 && period > 0)
+    {
+        return static_cast<size_t>(std::ceil(static_cast<double>(quota) / static_cast<double>(period)));
+    }
+
+    return 0;
+}
+#endif
+
+size_t Sonne::GetDefaultJobCount()
+{
+    size_t jobs = static_cast<size_t>(std::thread::hardware_concurrency());
+
+#ifdef __linux__
+    cpu_set_t affinity;
+
+    CPU_ZERO(&affinity);
+
+    // respect cpu pinning from things like taskset or a docker cpuset
+    if (sched_getaffinity(0, sizeof(affinity), &affinity) == 0)
+    {
+        size_t allowed = static_cast<size_t>(CPU_COUNT(&affinity));
+
+        if (allowed > 0 && (jobs == 0 || allowed < jobs))
+        {
+            jobs = allowed;
+        }
+    }
+
+    size_t quota = GetCgroupCpuLimit();
+
+    if (quota > 0 && (jobs == 0 || quota < jobs))
+    {
+        jobs = quota;
+    }
+#endif
+
+    return std::max<size_t>(jobs, 1);
+}
+
+ThreadPool::ThreadPool(size_t workers)
+    :
+    m_queued(0),
+    m_nextQueue(0)
+{
+    if (workers == 0)
+    {
+        workers = GetDefaultJobCount();
+    }
+
+    // every queue has to exist before any worker starts looking through them for tasks
+    for (size_t index = 0; index < workers; index++)
+    {
+        m_queues.push_back(std::unique_ptr<WorkerQueue>(new WorkerQueue()));
+    }
+
+    m_workers.reserve(workers);
+
+    for (size_t index = 0; index < workers; index++)
+    {
+        m_workers.emplace_back(&ThreadPool::_WorkerLoop, this, index);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    Wait();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_stopping = true;
+    }
+
+    m_taskReady.notify_all();
+
+    for (auto& worker : m_workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::Submit(std::function<void(size_t)> task)
+{
+    // spread tasks over the queues in turn, so tasks submitted in order of importance are started in that order
+    Submit(std::move(task), m_nextQueue++ % m_queues.size());
+}
+
+void ThreadPool::Submit(std::function<void(size_t)> task, size_t worker)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_pending++;
+    }
+
+    {
+        WorkerQueue& queue = *m_queues.at(worker);
+
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        queue.tasks.push_back(std::move(task));
+
+        m_queued++;
+    }
+
+    {
+        // take the lock so that a worker can not miss the task between checking for one and going to sleep
+        std::lock_guard<std::mutex> lock(m_mutex);
+    }
+
+    m_taskReady.notify_one();
+}
+
+void ThreadPool::Wait()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    m_idle.wait(lock, [this]() { return m_pending == 0; });
+}
+
+void ThreadPool::WaitForRoom(size_t limit)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    m_roomWaiters++;
+
+    m_idle.wait(lock, [this, limit]() { return m_pending < limit; });
+
+    m_roomWaiters--;
+}
+
+bool ThreadPool::_TakeTask(size_t worker, std::function<void(size_t)>& task)
+{
+    // look through the queue of this worker first, then every other queue starting from the next worker over
+    for (size_t offset = 0; offset < m_queues.size(); offset++)
+    {
+        WorkerQueue& queue = *m_queues[(worker + offset) % m_queues.size()];
+
+        std::lock_guard<std::mutex> lock(queue.mutex);
+
+        if (queue.tasks.empty())
+        {
+            continue;
+        }
+
+        // thieves take from the front as well, since the oldest task is the one the submitter wanted ran first
+        task = std::move(queue.tasks.front());
+
+        queue.tasks.pop_front();
+
+        m_queued--;
+
+        return true;
+    }
+
+    return false;
+}
+
+void ThreadPool::_WorkerLoop(size_t worker)
+{
+    while (true)
+    {
+        std::function<void(size_t)> task;
+
+        if (!_TakeTask(worker, task))
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            m_taskReady.wait(lock, [this]() { return m_stopping || m_queued > 0; });
+
+            if (m_queued == 0)
+            {
+                return; // only exit once stopping and every queue has been drained
+            }
+
+            continue; // another worker may grab the task first, in which case this goes back to sleep
+        }
+
+        task(worker);
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            m_pending--;
+
+            if (m_pending == 0 || m_roomWaiters > 0)
+            {
+                m_idle.notify_all();
+            }
+        }
+    }
+}
@@ -0,0 +1,823 @@
+#include "sonne/pch.hpp"
+#include "sonne/watcher.hpp"
+
+#include "sonne/config.hpp"
+#include "sonne/file.hpp"
+#include "sonne/thread_pool.hpp"
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+using namespace Sonne;
+
+constexpr int Watcher::SettleTime;
+constexpr int Watcher::MaxDelay;
+
+#ifdef __linux__
+// what changes inside of a watched directory are listened for, which never includes only reading a file
+static constexpr uint32_t WatchMask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_FROM |
+    IN_MOVED_TO | IN_ONLYDIR;
+#endif
+
+/**
+ Build the entry that a walk would have found for a path, enough to check whether the walk would have skipped it.
+ */
+static Entry MakeEntry(const std::string& path, bool isDirectory, size_t fileSize)
+{
+    Entry entry;
+
+    size_t nameStart = path.find_last_of(Separator);
+
+    entry.fullPath    = path;
+    entry.fileName    = path.substr((nameStart == std::string::npos) ? 0 : nameStart + 1);
+    entry.isHidden    = (!entry.fileName.empty() && entry.fileName[0] == '.');
+    entry.isDirectory = isDirectory;
+    entry.fileSize    = fileSize;
+
+    if (isDirectory)
+    {
+        entry.fileName += Separator;
+    }
+
+    return entry;
+}
+
+/**
+ Look up the device and inode of what a path leads to, following links.
+ */
+static bool LookUpIdentity(const std::string& path, uint64_t& device, uint64_t& inode)
+{
+#ifdef __linux__
+    struct stat statBuffer;
+
+    if (stat(path.c_str(), &statBuffer) != 0)
+    {
+        return false;
+    }
+
+    device = static_cast<uint64_t>(statBuffer.st_dev);
+    inode  = static_cast<uint64_t>(statBuffer.st_ino);
+
+    return true;
+#else
+    (void)path;
+    (void)device;
+    (void)inode;
+
+    return false;
+#endif
+}
+
+Watcher::Watcher(const std::string& path, std::shared_ptr<Config> config)
+    :
+    m_path(GetFSEntry(path).fullPath),
+    m_baseConfig(std::make_shared<Config>(*config)),
+    m_config(config),
+    m_pool(new ThreadPool(config->GetJobs())),
+    m_buffer(new ReadBuffer())
+{
+    // untracked files change as much as tracked ones, so they have to be walked to be watched
+    m_baseConfig->SetUseGitIndex(false);
+}
+
+Watcher::~Watcher()
+{
+#ifdef __linux__
+    if (m_inotify >= 0)
+    {
+        close(m_inotify);
+    }
+#endif
+}
+
+bool Watcher::IsSupported()
+{
+#ifdef __linux__
+    return true;
+#else
+    return false;
+#endif
+}
+
+const DirectoryInfo& Watcher::Start()
+{
+#ifdef __linux__
+    if (m_inotify >= 0)
+    {
+        close(m_inotify); // dropping the old descriptor drops every watch on it and any changes still queued
+    }
+
+    m_inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+    if (m_inotify < 0)
+    {
+        fmt::print("Failed to start watching for changes: {}\n", strerror(errno));
+    }
+#endif
+
+    m_files.clear();
+    m_folders.clear();
+    m_directories.clear();
+    m_watches.clear();
+
+    m_identities.reset(new IdentitySet());
+    m_identityPaths.clear();
+
+    // every full count starts from the config that was given, as the last one merged in the configs it found
+    m_config = std::make_shared<Config>(*m_baseConfig);
+
+    bool followLinks = m_config->GetFollowSymlinks();
+
+    m_counter.reset(new DirectoryCounter(m_path, m_config));
+
+    // the full count runs on the same workers that count changed files, rather than making its own every time
+    m_counter->SetPool(m_pool.get());
+
+    // the walk only counts the first path to each file and directory, so each one visited takes its identity
+    m_counter->SetFileVisitor([this, followLinks](const std::string& path, const CountInfo& count) {
+        uint64_t device = 0;
+        uint64_t inode  = 0;
+
+        bool found = followLinks && LookUpIdentity(path, device, inode);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_files[path] = count;
+
+        if (found)
+        {
+            _Claim(path, device, inode);
+        }
+    });
+
+    // a directory is watched before its entries are read, so anything made after the walk passes it still shows up
+    m_counter->SetDirectoryVisitor([this, followLinks](
+        const std::string& path,
+        const std::shared_ptr<Config>& config,
+        const std::shared_ptr<const IgnoreScope>& ignores) {
+        uint64_t device = 0;
+        uint64_t inode  = 0;
+
+        bool found = followLinks && LookUpIdentity(path, device, inode);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        _Watch(path, config, ignores);
+
+        if (found)
+        {
+            _Claim(path, device, inode);
+        }
+    });
+
+    m_info = m_counter->Run();
+
+    // the totals of each directory are only built once every file is in, rather than on each worker as it counts
+    for (auto& file : m_files)
+    {
+        _AddToFolders(file.first, file.second, false);
+    }
+
+    m_globalIgnores = IgnoreMatcher();
+
+    std::string globalPath = GetGlobalExcludesPath();
+
+    if (m_config->GetGitIgnore() && !globalPath.empty())
+    {
+        m_globalIgnores.AddFile(globalPath);
+    }
+
+    return m_info;
+}
+
+bool Watcher::Update(int timeout)
+{
+#ifdef __linux__
+    if (m_inotify < 0)
+    {
+        return false;
+    }
+
+    struct pollfd descriptor = { m_inotify, POLLIN, 0 };
+
+    if (poll(&descriptor, 1, timeout) <= 0)
+    {
+        return false;
+    }
+
+    // what changed by its full path, mapped to the path of the directory it is in, so repeats of a path are merged
+    std::map<std::string, std::string> files;
+    std::map<std::string, std::string> directories;
+
+    bool restart = false;
+
+    auto start = std::chrono::steady_clock::now();
+
+    alignas(struct inotify_event) char buffer[64 * 1024];
+
+    while (true)
+    {
+        ssize_t size = read(m_inotify, buffer, sizeof(buffer));
+
+        for (ssize_t offset = 0; offset < size;)
+        {
+            const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(buffer + offset);
+
+            offset += sizeof(struct inotify_event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                restart = true;
+
+                continue;
+            }
+
+            auto find = m_directories.find(event->wd);
+
+            if (find == m_directories.end())
+            {
+                continue;
+            }
+
+            // the watch is gone once its directory is, which is only the same directory if the path still points to it
+            if (event->mask & IN_IGNORED)
+            {
+                auto watch = m_watches.find(find->second.path);
+
+                if (watch != m_watches.end() && watch->second == event->wd)
+                {
+                    m_watches.erase(watch);
+                }
+
+                m_directories.erase(find);
+
+                continue;
+            }
+
+            // changes to the watched directory itself also show up as a change to an entry in its parent
+            if (event->len == 0)
+            {
+                continue;
+            }
+
+            std::string name = event->name;
+
+            if (name == ".sonne.json" || (name == ".gitignore" && find->second.config->GetGitIgnore()))
+            {
+                restart = true;
+
+                continue;
+            }
+
+            std::string path = fmt::format("{}{}{}", find->second.path, Separator, name);
+
+            if (!(event->mask & IN_ISDIR))
+            {
+                files[path] = find->second.path;
+            }
+            else if (event->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))
+            {
+                directories[path] = find->second.path;
+            }
+        }
+
+        int elapsed = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start).count());
+
+        // keep gathering until nothing has changed for a moment, or the burst has gone on for too long
+        if (elapsed >= MaxDelay || poll(&descriptor, 1, std::min(SettleTime, MaxDelay - elapsed)) <= 0)
+        {
+            break;
+        }
+    }
+
+    auto counting = std::chrono::steady_clock::now();
+
+    if (restart)
+    {
+        Start();
+
+        m_changedFiles = m_files.size();
+    }
+    else
+    {
+        m_changedFiles = files.size() + directories.size();
+
+        // a directory that changed is forgotten along with everything below it, then walked again if it is still there
+        for (auto& directory : directories)
+        {
+            _Forget(directory.first);
+
+            auto parent = m_watches.find(directory.second);
+
+            struct stat statBuffer;
+
+            const char* path = directory.first.c_str();
+
+            int result = m_config->GetFollowSymlinks() ? stat(path, &statBuffer) : lstat(path, &statBuffer);
+
+            if (parent == m_watches.end() || result != 0 || !S_ISDIR(statBuffer.st_mode))
+            {
+                continue;
+            }
+
+            const WatchedDirectory& watched = m_directories.at(parent->second);
+
+            if (!m_counter->IsSkipped(MakeEntry(directory.first, true, 0), *watched.config, watched.ignores.get()))
+            {
+                _AddDirectory(directory.first, watched.config, watched.ignores);
+            }
+        }
+
+        for (auto& file : files)
+        {
+            auto parent = m_watches.find(file.second);
+
+            if (parent == m_watches.end())
+            {
+                _SetCount(file.first, nullptr);
+
+                continue;
+            }
+
+            _UpdateFile(file.first, m_directories.at(parent->second));
+        }
+    }
+
+    m_updateTime = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - counting).count();
+
+    return true;
+#else
+    (void)timeout;
+
+    return false;
+#endif
+}
+
+void Watcher::_Watch(
+    const std::string& path,
+    const std::shared_ptr<Config>& config,
+    const std::shared_ptr<const IgnoreScope>& ignores)
+{
+#ifdef __linux__
+    if (m_inotify < 0)
+    {
+        return;
+    }
+
+    int watch = inotify_add_watch(m_inotify, path.c_str(), WatchMask);
+
+    if (watch < 0)
+    {
+        if (errno == ENOSPC && !m_warned)
+        {
+            fmt::print("Ran out of inotify watches, raise fs.inotify.max_user_watches to watch every directory\n");
+
+            m_warned = true;
+        }
+
+        return;
+    }
+
+    m_directories[watch] = WatchedDirectory { path, config, ignores };
+
+    m_watches[path] = watch;
+#else
+    (void)path;
+    (void)config;
+    (void)ignores;
+#endif
+}
+
+void Watcher::_Forget(const std::string& path)
+{
+    std::string prefix = path + Separator;
+
+    std::vector<std::string> removed;
+
+    for (auto& file : m_files)
+    {
+        if (file.first.compare(0, prefix.size(), prefix) == 0)
+        {
+            removed.push_back(file.first);
+        }
+    }
+
+    for (const std::string& file : removed)
+    {
+        _SetCount(file, nullptr);
+    }
+
+    for (auto watch = m_watches.begin(); watch != m_watches.end();)
+    {
+        if (watch->first != path && watch->first.compare(0, prefix.size(), prefix) != 0)
+        {
+            watch++;
+
+            continue;
+        }
+
+#ifdef __linux__
+        inotify_rm_watch(m_inotify, watch->second);
+#endif
+
+        _Release(watch->first);
+
+        m_directories.erase(watch->second);
+
+        watch = m_watches.erase(watch);
+    }
+}
+
+void Watcher::_AddDirectory(
+    const std::string& path,
+    std::shared_ptr<Config> config,
+    std::shared_ptr<const IgnoreScope> ignores)
+{
+    struct QueuedDirectory
+    {
+
+        std::string path;
+
+        std::shared_ptr<Config> config;
+
+        std::shared_ptr<const IgnoreScope> ignores;
+
+    };
+
+    std::vector<QueuedDirectory> directories = { QueuedDirectory { path, config, ignores } };
+
+    DirectoryReader reader;
+
+    reader.SetFollowLinks(m_config->GetFollowSymlinks());
+
+    Entry entry;
+
+    while (!directories.empty())
+    {
+        QueuedDirectory directory = std::move(directories.back());
+
+        directories.pop_back();
+
+        if (!reader.Open(directory.path))
+        {
+            continue;
+        }
+
+        uint64_t device = 0;
+        uint64_t inode  = 0;
+
+        // a directory reached again through a link is already watched, or is the way into a loop
+        bool found = m_config->GetFollowSymlinks() && reader.GetIdentity(device, inode);
+
+        if (found && !_Claim(directory.path, device, inode))
+        {
+            reader.Close();
+
+            continue;
+        }
+
+        // the same as a walk, a config or ignore file in the directory applies to everything below it
+        if (reader.Contains(".sonne.json"))
+        {
+            std::string configPath = fmt::format("{}/.sonne.json", directory.path);
+
+            std::shared_ptr<Config> scoped = std::make_shared<Config>(*directory.config);
+
+            scoped->Parse(configPath);
+
+            m_config->AddLanguages(*scoped);
+
+            directory.config = scoped;
+        }
+
+        if (directory.config->GetGitIgnore())
+        {
+            bool isRepository = reader.Contains(".git");
+            bool hasIgnore    = reader.Contains(".gitignore");
+
+            if (isRepository || hasIgnore)
+            {
+                std::shared_ptr<IgnoreScope> scope = std::make_shared<IgnoreScope>();
+
+                scope->parent     = isRepository ? nullptr : directory.ignores;
+                scope->baseLength = directory.path.size() + 1;
+
+                if (isRepository)
+                {
+                    scope->matcher = m_globalIgnores;
+
+                    scope->matcher.AddFile(fmt::format("{}/.git/info/exclude", directory.path));
+                }
+
+                if (hasIgnore)
+                {
+                    scope->matcher.AddFile(fmt::format("{}/.gitignore", directory.path));
+                }
+
+                directory.ignores = scope;
+            }
+        }
+
+        _Watch(directory.path, directory.config, directory.ignores);
+
+        while (reader.Next(entry))
+        {
+            if (m_counter->IsSkipped(entry, *directory.config, directory.ignores.get()))
+            {
+                continue;
+            }
+
+            if (entry.isDirectory)
+            {
+                directories.push_back(QueuedDirectory { entry.fullPath, directory.config, directory.ignores });
+
+                continue;
+            }
+
+            // the same file reached by another link or a hard link is only counted the first time it is found
+            if (entry.inode != 0 && !_Claim(entry.fullPath, entry.device, entry.inode))
+            {
+                continue;
+            }
+
+            bool known = directory.config->HasLanguage(Counter::GetExtension(entry.fileName));
+
+            CountInfo count = Counter(entry.fullPath, entry.fileSize).Count(
+                known ? directory.config : m_config,
+                m_pool.get(),
+                m_buffer.get());
+
+            _SetCount(entry.fullPath, (count.files > 0) ? &count : nullptr);
+        }
+
+        reader.Close();
+    }
+}
+
+void Watcher::_UpdateFile(const std::string& path, const WatchedDirectory& directory)
+{
+#ifdef __linux__
+    struct stat statBuffer;
+
+    bool found = (stat(path.c_str(), &statBuffer) == 0);
+
+    // links to files are counted by a walk whether or not links are followed, so this follows them as well
+    if (!found || !S_ISREG(statBuffer.st_mode))
+    {
+        _SetCount(path, nullptr);
+
+        // a link to a directory is walked like one made in place when links are followed, and forgotten once gone
+        if (m_watches.count(path) > 0)
+        {
+            _Forget(path);
+        }
+
+        bool isDirectory = found && S_ISDIR(statBuffer.st_mode);
+
+        if (isDirectory && m_config->GetFollowSymlinks() &&
+            !m_counter->IsSkipped(MakeEntry(path, true, 0), *directory.config, directory.ignores.get()))
+        {
+            _AddDirectory(path, directory.config, directory.ignores);
+        }
+
+        return;
+    }
+
+    size_t fileSize = static_cast<size_t>(statBuffer.st_size);
+
+    Entry entry = MakeEntry(path, false, fileSize);
+
+    if (m_counter->IsSkipped(entry, *directory.config, directory.ignores.get()))
+    {
+        _SetCount(path, nullptr);
+
+        return;
+    }
+
+    // a new hard link or link to a file that is already counted is skipped, the same as in a walk
+    if (!_Claim(path, static_cast<uint64_t>(statBuffer.st_dev), static_cast<uint64_t>(statBuffer.st_ino)))
+    {
+        _SetCount(path, nullptr);
+
+        return;
+    }
+
+    // the walk counts a file that its own config has no language for with every language found, so this does too
+    bool known = directory.config->HasLanguage(Counter::GetExtension(entry.fileName));
+
+    CountInfo count = Counter(path, fileSize).Count(known ? directory.config : m_config, m_pool.get(), m_buffer.get());
+
+    _SetCount(path, (count.files > 0) ? &count : nullptr);
+#else
+    (void)path;
+    (void)directory;
+#endif
+}
+
+void Watcher::_SetCount(const std::string& path, const CountInfo* count)
+{
+    CountInfo& totals = m_info.totals.at("Totals");
+
+    if (count == nullptr)
+    {
+        _Release(path); // whatever the path led to can be counted through another path now
+    }
+
+    auto find = m_files.find(path);
+
+    if (find != m_files.end())
+    {
+        auto language = m_info.totals.find(find->second.language);
+
+        if (language != m_info.totals.end())
+        {
+            language->second -= find->second;
+
+            // a language with no files left is dropped, the same as one a full count never found
+            if (language->second.files == 0)
+            {
+                m_info.totals.erase(language);
+            }
+        }
+
+        totals -= find->second;
+
+        _AddToFolders(path, find->second, true);
+
+        if (count == nullptr)
+        {
+            m_files.erase(find);
+        }
+        else
+        {
+            find->second = *count;
+        }
+    }
+    else if (count != nullptr)
+    {
+        m_files.insert(std::make_pair(path, *count));
+    }
+
+    if (count != nullptr)
+    {
+        m_info.Add(*count);
+
+        totals += *count;
+
+        _AddToFolders(path, *count, false);
+    }
+}
+
+bool Watcher::_Claim(const std::string& path, uint64_t device, uint64_t inode)
+{
+    if (!m_config->GetFollowSymlinks())
+    {
+        return true;
+    }
+
+    std::pair<uint64_t, uint64_t> identity = std::make_pair(device, inode);
+
+    auto find = m_identityPaths.find(path);
+
+    if (find != m_identityPaths.end())
+    {
+        if (find->second == identity)
+        {
+            return true; // the path already has it, such as a file that changed in place
+        }
+
+        // the path leads somewhere else now, such as a file that was replaced by renaming another over it
+        m_identities->Erase(find->second.first, find->second.second);
+
+        m_identityPaths.erase(find);
+    }
+
+    if (!m_identities->Insert(device, inode))
+    {
+        return false;
+    }
+
+    m_identityPaths.insert(std::make_pair(path, identity));
+
+    return true;
+}
+
+void Watcher::_Release(const std::string& path)
+{
+    auto find = m_identityPaths.find(path);
+
+    if (find == m_identityPaths.end())
+    {
+        return;
+    }
+
+    m_identities->Erase(find->second.first, find->second.second);
+
+    m_identityPaths.erase(find);
+}
+
+void Watcher::_AddToFolders(const std::string& path, const CountInfo& count, bool remove)
+{
+    std::string folder = path;
+
+    // step up one directory at a time, stopping once the root itself has been added to
+    while (folder.size() > m_path.size())
+    {
+        size_t last = folder.find_last_of(Separator);
+
+        if (last == std::string::npos || last < m_path.size())
+        {
+            break;
+        }
+
+        folder.resize(last);
+
+        std::map<std::string, CountInfo>& languages = m_folders[folder];
+
+        auto find = languages.find(count.language);
+
+        if (!remove)
+        {
+            if (find != languages.end())
+            {
+                find->second += count;
+            }
+            else
+            {
+                languages.insert(std::make_pair(count.language, count));
+            }
+
+            continue;
+        }
+
+        if (find != languages.end())
+        {
+            find->second -= count;
+
+            if (find->second.files == 0)
+            {
+                languages.erase(find);
+            }
+        }
+
+        if (languages.empty())
+        {
+            m_folders.erase(folder);
+        }
+    }
+}
+
+bool Watcher::GetTotals(const std::string& path, DirectoryInfo& info) const
+{
+    info.totals.clear();
+
+    auto folder = m_folders.find(path);
+
+    if (folder != m_folders.end())
+    {
+        info.totals = folder->second;
+    }
+    else
+    {
+        auto file = m_files.find(path);
+
+        if (file == m_files.end())
+        {
+            return false;
+        }
+
+        info.totals.insert(std::make_pair(file->second.language, file->second));
+    }
+
+    CountInfo total = {};
+
+    total.language = "Totals";
+    total.files    = 0;
+
+    for (auto& language : info.totals)
+    {
+        total += language.second;
+    }
+
+    info.totals.insert(std::make_pair("Totals", total));
+
+    return true;
+}
+
+bool Watcher::GetFile(const std::string& path, CountInfo& count) const
+{
+    auto find = m_files.find(path);
+
+    if (find == m_files.end())
+    {
+        return false;
+    }
+
+    count = find->second;
+
+    return true;
+}
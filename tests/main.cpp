@@ -5,7 +5,22 @@
 #include <sonne/file.hpp>
 #include <sonne/config.hpp>
 #include <sonne/config_generator.hpp>
+#include <sonne/content_table.hpp>
+#include <sonne/count_cache.hpp>
 #include <sonne/directory_counter.hpp>
+#include <sonne/file_tree.hpp>
+#include <sonne/git_index.hpp>
+#include <sonne/identity_set.hpp>
+#include <sonne/ignore.hpp>
+#include <sonne/thread_pool.hpp>
+#include <sonne/watcher.hpp>
+#include <sonne/server.hpp>
+#include <sonne/scan.hpp>
+#include <sonne/automaton.hpp>
+
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
 
 using namespace Sonne;
 
@@ -40,6 +55,29 @@ TEST_CASE("filesystem custom functions work correctly")
         REQUIRE(entry.fileSize == 262);
     }
 
+    SECTION("mapped and read file views see the same bytes")
+    {
+        ReadBuffer buffer;
+
+        FileView read;
+        FileView mapped;
+
+        REQUIRE(read.Open("samples/test.py", buffer));
+        REQUIRE(mapped.Open("samples/test.py", buffer, 0)); // a zero threshold always maps
+
+        REQUIRE(!read.IsMapped());
+        REQUIRE(mapped.IsMapped());
+
+        REQUIRE(read.GetSize() == 262);
+        REQUIRE(mapped.GetSize() == 262);
+
+        REQUIRE(std::memcmp(read.GetData(), mapped.GetData(), read.GetSize()) == 0);
+
+        FileView missing;
+
+        REQUIRE(!missing.Open("samples/does_not_exist.txt", buffer));
+    }
+
     SECTION("filesystem walk works")
     {
         std::vector<Entry> entries = WalkDirectory("dir_walk");
@@ -65,6 +103,98 @@ TEST_CASE("filesystem custom functions work correctly")
         // the initial amount of entries including directories should be 8 entries
         REQUIRE(totalEntries == 8);
     }
+
+    SECTION("directory reader lists one level and finds names in the listing")
+    {
+        DirectoryReader reader;
+
+        REQUIRE(reader.Open("dir_walk"));
+
+        REQUIRE(reader.Contains("first_dir"));
+        REQUIRE(!reader.Contains("does_not_exist"));
+
+        size_t listed = 0;
+
+        Entry entry;
+
+        while (reader.Next(entry))
+        {
+            std::string name = entry.fileName;
+
+            // directories keep a separator on the end of their name
+            if (entry.isDirectory)
+            {
+                REQUIRE(name.back() == Separator);
+
+                name.pop_back();
+            }
+
+            REQUIRE(entry.fullPath == fmt::format("dir_walk{}{}", Separator, name));
+
+            listed++;
+        }
+
+        reader.Close();
+
+        REQUIRE(listed == 4);
+        REQUIRE(reader.GetSyscalls() > 0);
+
+        DirectoryReader missing;
+
+        REQUIRE(!missing.Open("does_not_exist"));
+    }
+
+#ifndef _WIN32
+    SECTION("fifos are skipped instead of blocking the count")
+    {
+        mkdir("special_files", 0755);
+
+        std::ofstream("special_files/plain.txt") << "one\ntwo\n";
+
+        REQUIRE(mkfifo("special_files/pipe", 0644) == 0);
+
+        std::shared_ptr<Config> config = GenerateDefaultConfig();
+
+        DirectoryInfo info = DirectoryCounter("special_files", config).Run();
+
+        REQUIRE(info.totals.at("Totals").files == 1);
+        REQUIRE(info.walkSyscalls > 0);
+
+        unlink("special_files/pipe");
+        unlink("special_files/plain.txt");
+        rmdir("special_files");
+    }
+
+    SECTION("every listing keeps modified times down to the nanosecond")
+    {
+        mkdir("stamped", 0755);
+
+        std::ofstream("stamped/file.txt") << "one\n";
+
+        struct timespec times[2] = { { 1, 123456789 }, { 1, 123456789 } };
+
+        REQUIRE(utimensat(AT_FDCWD, "stamped/file.txt", times, 0) == 0);
+
+        std::vector<Entry> walked = WalkDirectory("stamped");
+
+        REQUIRE(walked.size() == 1);
+        REQUIRE(walked[0].modifiedTime == 1123456789LL);
+
+        DirectoryReader reader;
+
+        REQUIRE(reader.Open("stamped"));
+
+        Entry entry;
+
+        REQUIRE(reader.Next(entry));
+        REQUIRE(entry.modifiedTime == 1123456789LL);
+
+        reader.Close();
+
+        unlink("stamped/file.txt");
+        rmdir("stamped");
+    }
+#endif
 }
 
 TEST_CASE("config works properly")
@@ -195,6 +325,121 @@ TEST_CASE("counter works properly")
         REQUIRE(info.commentLines == 9);
     }
 
+    SECTION("streaming in chunks matches counting from one buffer")
+    {
+        std::vector<std::string> samples = {
+            "samples/test.cpp",
+            "samples/test.hpp",
+            "samples/test.java",
+            "samples/test.js",
+            "samples/test.lua",
+            "samples/test.py",
+            "samples/test.ts",
+            "samples/test.txt"
+        };
+
+        std::shared_ptr<Config> streamConfig = GenerateDefaultConfig();
+
+        streamConfig->SetStreamThreshold(0); // stream every file no matter the size
+
+        // small chunks make sure that tokens get split across chunk boundaries
+        for (size_t chunkSize : { 1, 2, 3, 5, 16, 4096 })
+        {
+            streamConfig->SetChunkSize(chunkSize);
+
+            for (auto& sample : samples)
+            {
+                CountInfo expected = Counter(sample).Count(config);
+                CountInfo streamed = Counter(sample).Count(streamConfig);
+
+                REQUIRE(streamed.language == expected.language);
+                REQUIRE(streamed.totalLines == expected.totalLines);
+                REQUIRE(streamed.emptyLines == expected.emptyLines);
+                REQUIRE(streamed.codeLines == expected.codeLines);
+                REQUIRE(streamed.commentLines == expected.commentLines);
+            }
+        }
+    }
+
+    SECTION("counting segments in parallel matches counting serially")
+    {
+        ThreadPool pool(4);
+
+        std::shared_ptr<Config> parallelConfig = GenerateDefaultConfig();
+
+        parallelConfig->SetParallelThreshold(0); // split every file no matter the size
+
+        // tiny segments and chunks so that segments begin inside of block comments and strings
+        for (size_t segmentSize : { 1, 8, 32, 100 })
+        {
+            parallelConfig->SetSegmentSize(segmentSize);
+            parallelConfig->SetChunkSize(segmentSize + 3);
+
+            for (auto& sample : { "samples/test.cpp", "samples/test.java", "samples/test.lua", "samples/test.py" })
+            {
+                CountInfo expected = Counter(sample).Count(config);
+                CountInfo parallel = Counter(sample).Count(parallelConfig, &pool);
+
+                REQUIRE(parallel.language == expected.language);
+                REQUIRE(parallel.files == 1);
+                REQUIRE(parallel.totalLines == expected.totalLines);
+                REQUIRE(parallel.emptyLines == expected.emptyLines);
+                REQUIRE(parallel.codeLines == expected.codeLines);
+                REQUIRE(parallel.commentLines == expected.commentLines);
+            }
+        }
+    }
+
+    SECTION("counting with metadata from the walk matches counting by path")
+    {
+        CountInfo expected = Counter("samples/test.java").Count(config);
+
+        Entry file = GetFSEntry("samples/test.java");
+
+        CountInfo known = Counter("samples/test.java", file.fileSize).Count(config);
+
+#ifndef _WIN32
+        int directory = open("samples", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        REQUIRE(directory >= 0);
+
+        // open relative to the directory handle using only the file name at the end of the path
+        CountInfo relative = Counter("samples/test.java", file.fileSize, directory, 8).Count(config);
+
+        close(directory);
+
+        REQUIRE(relative.codeLines == expected.codeLines);
+        REQUIRE(relative.commentLines == expected.commentLines);
+        REQUIRE(relative.totalLines == expected.totalLines);
+#endif
+
+        REQUIRE(known.language == expected.language);
+        REQUIRE(known.codeLines == expected.codeLines);
+        REQUIRE(known.commentLines == expected.commentLines);
+        REQUIRE(known.emptyLines == expected.emptyLines);
+        REQUIRE(known.totalLines == expected.totalLines);
+    }
+
+    SECTION("lines only mode keeps total and empty lines")
+    {
+        std::shared_ptr<Config> linesConfig = GenerateDefaultConfig();
+
+        linesConfig->SetLinesOnly(true);
+
+        for (auto sample : { "samples/test.cpp", "samples/test.lua", "samples/test.py", "samples/test.txt" })
+        {
+            CountInfo expected = Counter(sample).Count(config);
+            CountInfo lines    = Counter(sample).Count(linesConfig);
+
+            REQUIRE(lines.linesOnly);
+            REQUIRE(lines.language == expected.language);
+            REQUIRE(lines.totalLines == expected.totalLines);
+            REQUIRE(lines.emptyLines == expected.emptyLines);
+            REQUIRE(lines.codeLines == 0);
+            REQUIRE(lines.commentLines == 0);
+        }
+    }
+
     SECTION("count code reports correctly for test.lua")
     {
         Counter counter("samples/test.lua");
@@ -210,6 +455,185 @@ TEST_CASE("counter works properly")
     }
 }
 
+TEST_CASE("scan kernel works properly")
+{
+    // generate a buffer with a mix of stop bytes, whitespace and plain code in runs of varying length
+    std::string buffer;
+
+    uint32_t seed = 1234;
+
+    for (size_t index = 0; index < 4096; index++)
+    {
+        seed = seed * 1103515245 + 12345;
+
+        const char choices[] = { 'a', 'b', ' ', '\t', 'x', 'y', 'z', '"', '/', '\n' };
+
+        // make stop bytes rare so that long runs are skipped over by the vector blocks
+        size_t choice = (seed >> 16) % 64;
+
+        buffer.push_back((choice < 10) ? choices[choice] : choices[choice % 7]);
+    }
+
+    ScanSet stops;
+
+    stops.Add('\n');
+    stops.Add('"');
+    stops.Add('/');
+
+    // every kernel the cpu can run is checked against a plain loop, not only the one picked for this cpu
+    auto requireMatchesLoop = [&buffer, &stops](
+        const std::function<size_t(const char*, size_t, size_t, const ScanSet&, size_t&)>& scan) {
+        size_t index = 0;
+
+        while (index < buffer.size())
+        {
+            size_t expectedStop     = index;
+            size_t expectedNonBlank = 0;
+
+            while (expectedStop < buffer.size() && !stops.Contains(buffer[expectedStop]))
+            {
+                if (buffer[expectedStop] != ' ' && buffer[expectedStop] != '\t')
+                {
+                    expectedNonBlank++;
+                }
+
+                expectedStop++;
+            }
+
+            size_t nonBlank = 0;
+
+            size_t stop = scan(buffer.data(), index, buffer.size(), stops, nonBlank);
+
+            REQUIRE(stop == expectedStop);
+            REQUIRE(nonBlank == expectedNonBlank);
+
+            index = stop + 1;
+        }
+    };
+
+    requireMatchesLoop(&ScanToStop);
+
+    REQUIRE(IsScanKernelSupported(ScanKernel::SCALAR));
+
+    for (ScanKernel kernel : { ScanKernel::SCALAR, ScanKernel::SSE2, ScanKernel::AVX2 })
+    {
+        if (!IsScanKernelSupported(kernel))
+        {
+            continue;
+        }
+
+        requireMatchesLoop([kernel](const char* data, size_t start, size_t end, const ScanSet& set, size_t& nonBlank) {
+            return ScanToStopWith(kernel, data, start, end, set, nonBlank);
+        });
+    }
+}
+
+TEST_CASE("language automaton works properly")
+{
+    Language language;
+
+    language.name = "Lua";
+    language.lineComment = "--";
+    language.blockCommentBegin = "--[[";
+    language.blockCommentEnd = "]]";
+    language.stringDelimiters = { "\"", "'", "`" };
+
+    LanguageAutomaton automaton(language);
+
+    uint8_t normalKinds = LanguageAutomaton::GetKindsForState(CountState::NORMAL);
+
+    std::string text = "--[[ '` -- ]]";
+
+    SECTION("overlapping tokens are all matched in one walk")
+    {
+        REQUIRE(automaton.Match(text.data(), 0, text.size(), normalKinds) ==
+            (TOKEN_BLOCK_COMMENT_BEGIN | TOKEN_LINE_COMMENT));
+
+        // a partial token at the end of the buffer should not match
+        REQUIRE(automaton.Match(text.data(), 0, 3, normalKinds) == TOKEN_LINE_COMMENT);
+    }
+
+    SECTION("only the token kinds for the current state are matched")
+    {
+        REQUIRE(automaton.Match(text.data(), 5, text.size(), normalKinds) == TOKEN_STRING_DELIMITER);
+        REQUIRE(automaton.Match(text.data(), 6, text.size(), normalKinds) == TOKEN_STRING_DELIMITER);
+        REQUIRE(automaton.Match(text.data(), 11, text.size(), normalKinds) == 0);
+
+        uint8_t blockKinds = LanguageAutomaton::GetKindsForState(CountState::BLOCK_COMMENT);
+
+        REQUIRE(automaton.Match(text.data(), 0, text.size(), blockKinds) == 0);
+        REQUIRE(automaton.Match(text.data(), 11, text.size(), blockKinds) == TOKEN_BLOCK_COMMENT_END);
+    }
+
+    SECTION("stop sets hold the first byte of each token")
+    {
+        REQUIRE(automaton.GetStops(CountState::NORMAL).count == 6); // newline, carriage return, ", ', ` and -
+        REQUIRE(automaton.GetStops(CountState::BLOCK_COMMENT).Contains(']'));
+        REQUIRE(!automaton.GetStops(CountState::LINE_COMMENT).Contains('-'));
+    }
+}
+
+TEST_CASE("thread pool works properly")
+{
+    SECTION("default job count is always at least one")
+    {
+        REQUIRE(GetDefaultJobCount() >= 1);
+    }
+
+    SECTION("every submitted task runs before wait returns")
+    {
+        ThreadPool pool(4);
+
+        REQUIRE(pool.GetSize() == 4);
+
+        std::atomic<size_t> ran(0);
+
+        for (size_t index = 0; index < 1000; index++)
+        {
+            pool.Submit([&ran](size_t) { ran++; });
+        }
+
+        pool.Wait();
+
+        REQUIRE(ran.load() == 1000);
+    }
+
+    SECTION("idle workers steal tasks queued behind a busy worker")
+    {
+        ThreadPool pool(4);
+
+        std::mutex mutex;
+        std::condition_variable condition;
+
+        size_t finished = 0;
+
+        bool stolen = false;
+
+        // block whichever worker picks this up until every task queued behind it has been ran by someone else
+        pool.Submit([&](size_t) {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            stolen = condition.wait_for(lock, std::chrono::seconds(10), [&finished]() { return finished == 16; });
+        }, 0);
+
+        for (size_t index = 0; index < 16; index++)
+        {
+            pool.Submit([&](size_t) {
+                std::lock_guard<std::mutex> lock(mutex);
+
+                finished++;
+
+                condition.notify_all();
+            }, 0);
+        }
+
+        pool.Wait();
+
+        REQUIRE(stolen);
+        REQUIRE(finished == 16);
+    }
+}
+
 TEST_CASE("directory counter works properly")
 {
     // separate the previous case with two newlines
@@ -269,7 +693,7 @@ TEST_CASE("directory counter works properly")
         REQUIRE(pathsMatch == expectedPaths.size());
 
         REQUIRE(newConfigs == 1);
-        REQUIRE(ignoredPaths == 3); // ignoring both files in 'ignore' as well as 'ignored.java'
+        REQUIRE(ignoredPaths == 2); // ignoring the 'ignore' directory as a whole as well as 'ignored.java'
     }
 
     config = GenerateDefaultConfig(); // regenerate config to reset ignores
@@ -376,4 +800,902 @@ TEST_CASE("directory counter works properly")
             REQUIRE(expectInfo.commentLines == entry.second.commentLines);
         }
     }
-}
\ No newline at end of file
+
+    SECTION("walking directories on the pool finds every file and keeps ignores")
+    {
+        config->SetJobs(4);
+
+        DirectoryInfo walked = DirectoryCounter("dir_walk", config).Run();
+
+        REQUIRE(walked.totals.at("Totals").files == 5);
+
+        // the config at the root of this directory ignores a subdirectory and a file
+        DirectoryInfo ignored = DirectoryCounter("ignore_test", config).Run();
+
+        REQUIRE(ignored.totals.at("Totals").files == 2);
+    }
+
+    config = GenerateDefaultConfig(); // regenerate config to reset ignores
+
+    SECTION("languages from configs found later in the walk still apply to every file")
+    {
+        DirectoryInfo info = DirectoryCounter("late_config", config).Run();
+
+        REQUIRE(info.totals.count("Late Language") > 0);
+
+        CountInfo& late = info.totals.at("Late Language");
+
+        REQUIRE(late.files == 2);
+        REQUIRE(late.totalLines == 8); // both files end in a newline, which leaves an empty last line
+        REQUIRE(late.emptyLines == 3);
+        REQUIRE(late.codeLines == 3);
+        REQUIRE(late.commentLines == 2);
+
+        REQUIRE(info.totals.at("Totals").files == 2);
+
+        // only the languages of the nested config are used by the whole walk, the rest stays with its directory
+        REQUIRE(config->HasLanguage("late"));
+        REQUIRE(config->GetIgnoreHidden());
+    }
+
+    config = GenerateDefaultConfig(); // regenerate config to drop the language from the nested config
+
+    SECTION("small files are packed into batches by size")
+    {
+        size_t budget = 3 * CountBatch::FileCost;
+
+        CountBatch large;
+
+        // larger than a batch, so it fills one on its own
+        REQUIRE(large.Add(0, budget, budget));
+
+        CountBatch small;
+
+        // the rest only cost the overhead of opening them, so three fit into each batch
+        REQUIRE(!small.Add(1, 0, budget));
+        REQUIRE(!small.Add(2, 0, budget));
+        REQUIRE(small.Add(3, 0, budget));
+
+        REQUIRE(small.files.size() == 3);
+
+        // counting in batches of a single file still adds up to the same totals
+        config->SetBatchSize(0);
+
+        DirectoryInfo single = DirectoryCounter("samples", config).Run();
+
+        config->SetBatchSize(1024 * 1024);
+
+        DirectoryInfo batched = DirectoryCounter("samples", config).Run();
+
+        REQUIRE(single.totals.at("Totals").files == batched.totals.at("Totals").files);
+        REQUIRE(single.totals.at("Totals").totalLines == batched.totals.at("Totals").totalLines);
+        REQUIRE(single.totals.at("Totals").codeLines == batched.totals.at("Totals").codeLines);
+        REQUIRE(single.totals.at("Totals").commentLines == batched.totals.at("Totals").commentLines);
+    }
+
+#ifndef _WIN32
+    SECTION("gitignore files prune the walk with per directory scoping")
+    {
+        auto write = [](const std::string& path, const std::string& contents) {
+            std::ofstream(path) << contents;
+        };
+
+        mkdir("git_ignore", 0755);
+        mkdir("git_ignore/.git", 0755);
+        mkdir("git_ignore/.git/info", 0755);
+        mkdir("git_ignore/build", 0755);
+        mkdir("git_ignore/sub", 0755);
+
+        write("git_ignore/.git/info/exclude", "excluded.txt\n");
+        write("git_ignore/.gitignore", "# generated output\nbuild/\n*.log\n");
+        write("git_ignore/sub/.gitignore", "!keep.log\n");
+
+        write("git_ignore/main.cpp", "int main() {}\n");
+        write("git_ignore/debug.log", "log\n");
+        write("git_ignore/excluded.txt", "text\n");
+        write("git_ignore/build/out.cpp", "int out;\n");
+        write("git_ignore/sub/keep.log", "log\n");
+        write("git_ignore/sub/other.log", "log\n");
+
+        std::shared_ptr<Config> gitConfig = GenerateDefaultConfig();
+
+        DirectoryInfo followed = DirectoryCounter("git_ignore", gitConfig).Run();
+
+        // only main.cpp and the log taken back by the nested ignore file are left
+        REQUIRE(followed.totals.at("Totals").files == 2);
+
+        gitConfig->SetGitIgnore(false);
+
+        DirectoryInfo everything = DirectoryCounter("git_ignore", gitConfig).Run();
+
+        REQUIRE(everything.totals.at("Totals").files == 6);
+
+        const char* files[] = {
+            "git_ignore/.git/info/exclude", "git_ignore/.gitignore", "git_ignore/sub/.gitignore",
+            "git_ignore/main.cpp", "git_ignore/debug.log", "git_ignore/excluded.txt", "git_ignore/build/out.cpp",
+            "git_ignore/sub/keep.log", "git_ignore/sub/other.log"
+        };
+
+        for (const char* file : files)
+        {
+            unlink(file);
+        }
+
+        const char* directories[] = {
+            "git_ignore/.git/info", "git_ignore/.git", "git_ignore/build", "git_ignore/sub", "git_ignore"
+        };
+
+        for (const char* directory : directories)
+        {
+            rmdir(directory);
+        }
+    }
+
+    SECTION("the git index lists tracked files without walking the directory")
+    {
+        auto write = [](const std::string& path, const std::string& contents) {
+            std::ofstream(path, std::ios::binary) << contents;
+        };
+
+        auto putUInt32 = [](std::string& out, uint32_t value) {
+            out.push_back(static_cast<char>(value >> 24));
+            out.push_back(static_cast<char>(value >> 16));
+            out.push_back(static_cast<char>(value >> 8));
+            out.push_back(static_cast<char>(value));
+        };
+
+        // a version 2 index, where each entry is its stat fields, an object name, flags and a padded path
+        std::string index = "DIRC";
+
+        putUInt32(index, 2);
+        putUInt32(index, 5);
+
+        auto addEntry = [&](const std::string& path, uint32_t mode, uint32_t fileSize) {
+            size_t start = index.size();
+
+            index.append(24, '\0');
+
+            putUInt32(index, mode);
+            putUInt32(index, 0);
+            putUInt32(index, 0);
+            putUInt32(index, fileSize);
+
+            index.append(20, '\0');
+
+            index.push_back(static_cast<char>(path.size() >> 8));
+            index.push_back(static_cast<char>(path.size()));
+
+            index += path;
+
+            index.append(8 - (index.size() - start) % 8, '\0');
+        };
+
+        addEntry(".hidden/x.cpp", 0100644, 9);
+        addEntry("a.cpp", 0100644, 14);
+        addEntry("link", 0120000, 5);
+        addEntry("missing.cpp", 0100644, 20);
+        addEntry("sub/b.cpp", 0100755, 9);
+
+        index.append(20, '\0'); // the checksum, which is not checked
+
+        mkdir("git_index", 0755);
+        mkdir("git_index/.git", 0755);
+        mkdir("git_index/.hidden", 0755);
+        mkdir("git_index/sub", 0755);
+
+        write("git_index/.git/index", index);
+
+        write("git_index/.hidden/x.cpp", "int x;\n\n");
+        write("git_index/a.cpp", "int main() {}\n");
+        write("git_index/sub/b.cpp", "int b;\n\n");
+        write("git_index/untracked.cpp", "int untracked;\n");
+
+        std::vector<std::string> tracked;
+
+        REQUIRE(ReadGitIndex("git_index/.git", [&tracked](const GitIndexEntry& entry) {
+            tracked.push_back(std::string(entry.path, entry.pathLength));
+        }));
+
+        // the symlink is not a regular file, so it is left out
+        REQUIRE(tracked == std::vector<std::string> { ".hidden/x.cpp", "a.cpp", "missing.cpp", "sub/b.cpp" });
+
+        std::shared_ptr<Config> indexConfig = GenerateDefaultConfig();
+
+        indexConfig->SetUseGitIndex(true);
+
+        DirectoryInfo listed = DirectoryCounter("git_index", indexConfig).Run();
+
+        // the untracked file is never seen, the hidden one is skipped and the missing one counts as nothing
+        REQUIRE(listed.fromGitIndex);
+        REQUIRE(listed.totals.at("Totals").files == 2);
+        REQUIRE(listed.totals.at("Totals").codeLines == 2);
+
+        // a directory below the top of the work tree only counts the tracked files under it
+        DirectoryInfo nested = DirectoryCounter("git_index/sub", indexConfig).Run();
+
+        REQUIRE(nested.fromGitIndex);
+        REQUIRE(nested.totals.at("Totals").files == 1);
+
+        indexConfig->SetUseGitIndex(false);
+
+        DirectoryInfo walked = DirectoryCounter("git_index", indexConfig).Run();
+
+        REQUIRE_FALSE(walked.fromGitIndex);
+        REQUIRE(walked.totals.at("Totals").files == 3);
+
+        write("git_index/.git/index", "not an index at all");
+
+        REQUIRE_FALSE(ReadGitIndex("git_index/.git", [](const GitIndexEntry&) {}));
+
+        const char* files[] = {
+            "git_index/.git/index", "git_index/.hidden/x.cpp", "git_index/a.cpp", "git_index/sub/b.cpp",
+            "git_index/untracked.cpp"
+        };
+
+        for (const char* file : files)
+        {
+            unlink(file);
+        }
+
+        const char* directories[] = { "git_index/.git", "git_index/.hidden", "git_index/sub", "git_index" };
+
+        for (const char* directory : directories)
+        {
+            rmdir(directory);
+        }
+    }
+
+    SECTION("following links walks into linked directories and counts each file once")
+    {
+        mkdir("links", 0755);
+        mkdir("links/real", 0755);
+
+        std::ofstream("links/real/a.cpp") << "int a;\n";
+        std::ofstream("links/real/b.cpp") << "int b;\n";
+
+        REQUIRE(link("links/real/a.cpp", "links/real/c.cpp") == 0);     // a hard link to the same file
+        REQUIRE(symlink("real", "links/mirror") == 0);                   // a second path to every file
+        REQUIRE(symlink("..", "links/real/loop") == 0);                  // a loop back up to the top
+        REQUIRE(symlink("real/b.cpp", "links/alias.cpp") == 0);          // a link to a single file
+
+        std::shared_ptr<Config> linkConfig = GenerateDefaultConfig();
+
+        // by default links to files are counted as their own files and links to directories are skipped
+        DirectoryInfo skipped = DirectoryCounter("links", linkConfig).Run();
+
+        REQUIRE(skipped.totals.at("Totals").files == 4);
+        REQUIRE(skipped.duplicates == 0);
+
+        linkConfig->SetFollowSymlinks(true);
+
+        DirectoryInfo followed = DirectoryCounter("links", linkConfig).Run();
+
+        REQUIRE(followed.totals.at("Totals").files == 2);
+        REQUIRE(followed.totals.at("Totals").codeLines == 2);
+
+        // the hard link, the file link, the mirror and the loop all lead to something already found
+        REQUIRE(followed.duplicates == 4);
+
+        IdentitySet identities;
+
+        REQUIRE(identities.Insert(1, 2));
+        REQUIRE(identities.Insert(2, 1));
+        REQUIRE_FALSE(identities.Insert(1, 2));
+        REQUIRE(identities.GetSize() == 2);
+
+        const char* files[] = {
+            "links/real/loop", "links/real/c.cpp", "links/real/b.cpp", "links/real/a.cpp", "links/alias.cpp",
+            "links/mirror"
+        };
+
+        for (const char* file : files)
+        {
+            unlink(file);
+        }
+
+        rmdir("links/real");
+        rmdir("links");
+    }
+
+    SECTION("a count cache skips files that did not change since the last run")
+    {
+        mkdir("cached", 0755);
+
+        std::ofstream("cached/a.cpp") << "int a;\n// a\n";
+        std::ofstream("cached/b.cpp") << "int b;\n";
+        std::ofstream("cached/notes") << "plain text\n";
+
+        // files changed right before a run are never cached, so these are made to look older
+        auto age = [](const char* path) {
+            struct timeval times[2] = { { 1000000000, 0 }, { 1000000000, 0 } };
+
+            utimes(path, times);
+        };
+
+        age("cached/a.cpp");
+        age("cached/b.cpp");
+        age("cached/notes");
+
+        std::shared_ptr<Config> cacheConfig = GenerateDefaultConfig();
+
+        cacheConfig->SetCachePath("cached.cache");
+
+        DirectoryInfo cold = DirectoryCounter("cached", cacheConfig).Run();
+
+        REQUIRE(cold.usedCache);
+        REQUIRE(cold.cacheHits == 0);
+        REQUIRE(cold.totals.at("Totals").files == 3);
+
+        DirectoryInfo warm = DirectoryCounter("cached", cacheConfig).Run();
+
+        REQUIRE(warm.cacheHits == 3);
+        REQUIRE(warm.totals.at("Totals").files == 3);
+        REQUIRE(warm.totals.at("Totals").codeLines == cold.totals.at("Totals").codeLines);
+        REQUIRE(warm.totals.at("Totals").commentLines == cold.totals.at("Totals").commentLines);
+        REQUIRE(warm.totals.at("C/C++ Source").files == 2);
+
+        std::ofstream("cached/b.cpp") << "int b;\nint c;\n";
+
+        age("cached/b.cpp");
+
+        DirectoryInfo changed = DirectoryCounter("cached", cacheConfig).Run();
+
+        // only the file that changed is counted again
+        REQUIRE(changed.cacheHits == 2);
+        REQUIRE(changed.totals.at("Totals").codeLines == cold.totals.at("Totals").codeLines + 1);
+
+        // a different way of counting the same files does not reuse their counts
+        cacheConfig->SetLinesOnly(true);
+
+        DirectoryInfo linesOnly = DirectoryCounter("cached", cacheConfig).Run();
+
+        REQUIRE(linesOnly.cacheHits == 0);
+
+        // a cache written for one root is not used for another, where the root is the full path that was counted
+        CountCache cache;
+
+        REQUIRE(cache.Load("cached.cache", GetFSEntry("cached").fullPath));
+        REQUIRE(cache.GetSize() == 3);
+        REQUIRE_FALSE(cache.Load("cached.cache", "elsewhere"));
+
+        cache.Close();
+
+        unlink("cached/a.cpp");
+        unlink("cached/b.cpp");
+        unlink("cached/notes");
+        unlink("cached.cache");
+
+        rmdir("cached");
+    }
+
+    SECTION("identical files reuse the count of the first copy")
+    {
+        // the published test vectors of XXH64 with no seed
+        REQUIRE(HashContent("", 0) == 0xEF46DB3751D8E999ull);
+        REQUIRE(HashContent("abc", 3) == 0x44BC2CF5AD770999ull);
+        REQUIRE(HashContent("Nobody inspects the spammish repetition", 39) == 0xFBCEA83C8A378BF1ull);
+
+        mkdir("dedupe", 0755);
+        mkdir("dedupe/vendor", 0755);
+
+        std::string library = "// a library\nint library() {\n    return 1;\n}\n";
+
+        std::ofstream("dedupe/library.cpp") << library;
+        std::ofstream("dedupe/vendor/library.cpp") << library;
+        std::ofstream("dedupe/vendor/copy.cpp") << library;
+        std::ofstream("dedupe/vendor/library.txt") << library; // the same bytes, but counted as another language
+        std::ofstream("dedupe/main.cpp") << "int main() {}\n";
+
+        std::shared_ptr<Config> dedupeConfig = GenerateDefaultConfig();
+
+        DirectoryInfo every = DirectoryCounter("dedupe", dedupeConfig).Run();
+
+        dedupeConfig->SetDedupe(true);
+
+        DirectoryInfo deduped = DirectoryCounter("dedupe", dedupeConfig).Run();
+
+        REQUIRE(deduped.dedupedFiles == 2);
+        REQUIRE(deduped.dedupedBytes == 2 * library.size());
+
+        // every copy still adds to the totals as if it had been counted
+        REQUIRE(deduped.totals.at("Totals").files == every.totals.at("Totals").files);
+        REQUIRE(deduped.totals.at("Totals").codeLines == every.totals.at("Totals").codeLines);
+        REQUIRE(deduped.totals.at("Totals").commentLines == every.totals.at("Totals").commentLines);
+        REQUIRE(deduped.totals.at("Plain Text").commentLines == 0);
+
+        unlink("dedupe/library.cpp");
+        unlink("dedupe/vendor/library.cpp");
+        unlink("dedupe/vendor/copy.cpp");
+        unlink("dedupe/vendor/library.txt");
+        unlink("dedupe/main.cpp");
+
+        rmdir("dedupe/vendor");
+        rmdir("dedupe");
+    }
+
+    SECTION("a list of files is counted the same as walking them")
+    {
+        mkdir("listed", 0755);
+        mkdir("listed/src", 0755);
+
+        std::ofstream("listed/a.cpp") << "int a;\n// a\n";
+        std::ofstream("listed/src/b.cpp") << "int b;\n\n";
+        std::ofstream("listed/src/notes") << "plain text\n";
+        std::ofstream("listed/src/.sonne.json") << "{}\n";
+
+        DirectoryInfo walked = DirectoryCounter("listed", GenerateDefaultConfig()).Run();
+
+        // directories, missing files and configs in the list are all skipped
+        std::string paths[] = {
+            "listed/a.cpp", "listed/src", "listed/src/b.cpp", "listed/missing.cpp", "listed/src/notes",
+            "listed/src/.sonne.json"
+        };
+
+        std::string nulls;
+        std::string lines;
+
+        for (const std::string& path : paths)
+        {
+            nulls += path + '\0';
+            lines += path + "\r\n";
+        }
+
+        for (const std::string& text : { nulls, lines })
+        {
+            std::istringstream list(text);
+
+            DirectoryInfo info = DirectoryCounter(".", GenerateDefaultConfig()).RunFromList(list);
+
+            REQUIRE(info.listedFiles == 5);
+            REQUIRE(info.totals.size() == walked.totals.size());
+
+            for (auto& language : walked.totals)
+            {
+                REQUIRE(info.totals.at(language.first).files == language.second.files);
+                REQUIRE(info.totals.at(language.first).totalLines == language.second.totalLines);
+                REQUIRE(info.totals.at(language.first).emptyLines == language.second.emptyLines);
+                REQUIRE(info.totals.at(language.first).codeLines == language.second.codeLines);
+                REQUIRE(info.totals.at(language.first).commentLines == language.second.commentLines);
+            }
+        }
+
+        std::istringstream empty("");
+
+        REQUIRE(DirectoryCounter(".", GenerateDefaultConfig()).RunFromList(empty).totals.at("Totals").files == 0);
+
+        unlink("listed/a.cpp");
+        unlink("listed/src/b.cpp");
+        unlink("listed/src/notes");
+        unlink("listed/src/.sonne.json");
+
+        rmdir("listed/src");
+        rmdir("listed");
+    }
+
+#ifdef __linux__
+    SECTION("watching updates the totals for only the files that changed")
+    {
+        mkdir("watched", 0755);
+        mkdir("watched/src", 0755);
+
+        std::ofstream("watched/a.cpp") << "int a;\n// a\n";
+        std::ofstream("watched/src/b.cpp") << "int b;\n";
+        std::ofstream("watched/notes") << "plain text\n";
+
+        std::shared_ptr<Config> watchConfig = GenerateDefaultConfig();
+
+        Watcher watcher("watched", watchConfig);
+
+        const DirectoryInfo& first = watcher.Start();
+
+        REQUIRE(first.totals.at("Totals").files == 3);
+        REQUIRE(watcher.GetWatchCount() == 2);
+        REQUIRE(watcher.GetFileCount() == 3);
+
+        // nothing has changed yet, so there is nothing to wait for
+        REQUIRE_FALSE(watcher.Update(0));
+
+        // the totals after each change should be the same as counting everything again
+        auto requireSameAsRun = [&watcher]() {
+            DirectoryInfo run = DirectoryCounter("watched", GenerateDefaultConfig()).Run();
+
+            const DirectoryInfo& watched = watcher.GetInfo();
+
+            REQUIRE(watched.totals.size() == run.totals.size());
+
+            for (auto& language : run.totals)
+            {
+                REQUIRE(watched.totals.count(language.first) == 1);
+
+                const CountInfo& count = watched.totals.at(language.first);
+
+                REQUIRE(count.files == language.second.files);
+                REQUIRE(count.totalLines == language.second.totalLines);
+                REQUIRE(count.codeLines == language.second.codeLines);
+                REQUIRE(count.commentLines == language.second.commentLines);
+            }
+        };
+
+        std::ofstream("watched/a.cpp") << "int a;\nint b;\n// a\n";
+        std::ofstream("watched/src/c.cpp") << "int c;\n";
+
+        unlink("watched/notes");
+
+        REQUIRE(watcher.Update(1000));
+        REQUIRE(watcher.GetInfo().totals.count("Plain Text") == 0);
+
+        requireSameAsRun();
+
+        // a new directory is walked and watched, with the files made in it counted however quickly they show up
+        mkdir("watched/lib", 0755);
+
+        std::ofstream("watched/lib/d.cpp") << "int d;\n";
+        std::ofstream("watched/lib/.hidden.cpp") << "int hidden;\n";
+
+        REQUIRE(watcher.Update(1000));
+
+        while (watcher.Update(100))
+        {
+        }
+
+        REQUIRE(watcher.GetWatchCount() == 3);
+
+        requireSameAsRun();
+
+        unlink("watched/lib/d.cpp");
+        unlink("watched/lib/.hidden.cpp");
+
+        rmdir("watched/lib");
+
+        REQUIRE(watcher.Update(1000));
+
+        while (watcher.Update(100))
+        {
+        }
+
+        REQUIRE(watcher.GetWatchCount() == 2);
+        REQUIRE(watcher.GetFileCount() == 3);
+
+        requireSameAsRun();
+
+        unlink("watched/a.cpp");
+        unlink("watched/src/b.cpp");
+        unlink("watched/src/c.cpp");
+
+        rmdir("watched/src");
+        rmdir("watched");
+    }
+
+    SECTION("watching with links followed only counts what a link leads to the first time")
+    {
+        mkdir("linked", 0755);
+        mkdir("linked/src", 0755);
+        mkdir("outside", 0755);
+
+        std::ofstream("linked/a.cpp") << "int a;\n// a\n";
+        std::ofstream("linked/src/b.cpp") << "int b;\n";
+        std::ofstream("outside/c.cpp") << "int c;\n";
+
+        std::shared_ptr<Config> linkConfig = GenerateDefaultConfig();
+
+        linkConfig->SetFollowSymlinks(true);
+
+        Watcher watcher("linked", linkConfig);
+
+        REQUIRE(watcher.Start().totals.at("Totals").files == 2);
+
+        auto requireSameAsRun = [&watcher]() {
+            std::shared_ptr<Config> runConfig = GenerateDefaultConfig();
+
+            runConfig->SetFollowSymlinks(true);
+
+            DirectoryInfo run = DirectoryCounter("linked", runConfig).Run();
+
+            const DirectoryInfo& watched = watcher.GetInfo();
+
+            REQUIRE(watched.totals.size() == run.totals.size());
+
+            for (auto& language : run.totals)
+            {
+                REQUIRE(watched.totals.count(language.first) == 1);
+                REQUIRE(watched.totals.at(language.first).files == language.second.files);
+                REQUIRE(watched.totals.at(language.first).totalLines == language.second.totalLines);
+            }
+        };
+
+        auto settle = [&watcher]() {
+            REQUIRE(watcher.Update(1000));
+
+            while (watcher.Update(100))
+            {
+            }
+        };
+
+        // a loop back to the root, a second way into a directory already counted, and a hard link to a counted file
+        mkdir("linked/new", 0755);
+
+        REQUIRE(symlink("..", "linked/new/up") == 0);
+        REQUIRE(symlink("src", "linked/alias") == 0);
+        REQUIRE(link("linked/a.cpp", "linked/hard.cpp") == 0);
+
+        settle();
+
+        REQUIRE(watcher.GetInfo().totals.at("Totals").files == 2);
+
+        requireSameAsRun();
+
+        // a link to a directory outside of the root is walked the same as a directory made in place
+        REQUIRE(symlink("../outside", "linked/out") == 0);
+
+        settle();
+
+        REQUIRE(watcher.GetInfo().totals.at("Totals").files == 3);
+
+        requireSameAsRun();
+
+        unlink("linked/out");
+
+        settle();
+
+        REQUIRE(watcher.GetInfo().totals.at("Totals").files == 2);
+
+        requireSameAsRun();
+
+        unlink("linked/new/up");
+        unlink("linked/alias");
+        unlink("linked/hard.cpp");
+        unlink("linked/a.cpp");
+        unlink("linked/src/b.cpp");
+        unlink("outside/c.cpp");
+
+        rmdir("linked/new");
+        rmdir("linked/src");
+        rmdir("linked");
+        rmdir("outside");
+    }
+#endif
+#endif
+}
+
+TEST_CASE("file tree works properly", "[file_tree]")
+{
+    FileTree tree;
+
+    uint32_t root = tree.AddRoot("root");
+
+    std::vector<FileTree::Pending> children;
+
+    children.push_back(FileTree::Pending { "source", 0, true });
+    children.push_back(FileTree::Pending { "main.cpp", 120, false });
+
+    uint32_t first = tree.AddChildren(root, children);
+
+    REQUIRE(tree.GetParent(root) == FileTree::NoParent);
+    REQUIRE(tree.GetParent(first) == root);
+
+    REQUIRE(tree.IsDirectory(first));
+    REQUIRE(!tree.IsDirectory(first + 1));
+    REQUIRE(tree.GetFileSize(first + 1) == 120);
+
+    children.clear();
+
+    children.push_back(FileTree::Pending { "main.cpp", 64, false });
+
+    uint32_t nested = tree.AddChildren(first, children);
+
+    std::string path;
+
+    tree.GetPath(nested, path);
+
+    REQUIRE(path == fmt::format("root{}source{}main.cpp", Separator, Separator));
+
+    tree.GetPath(first + 1, path);
+
+    REQUIRE(path == fmt::format("root{}main.cpp", Separator));
+
+    tree.GetPath(root, path);
+
+    REQUIRE(path == "root");
+
+    SECTION("repeated names are only stored once")
+    {
+        size_t before = tree.GetMemoryUsage();
+
+        children.clear();
+
+        for (size_t index = 0; index < 100000; index++)
+        {
+            children.push_back(FileTree::Pending { fmt::format("file_{}.cpp", index % 100), 1, false });
+        }
+
+        tree.AddChildren(first, children);
+
+        REQUIRE(tree.GetSize() == 100004);
+
+        // each node is a couple dozen bytes, the names themselves barely add anything
+        REQUIRE((tree.GetMemoryUsage() - before) / 100000 < 32);
+
+        tree.GetPath(tree.GetSize() - 1, path);
+
+        REQUIRE(path == fmt::format("root{}source{}file_99.cpp", Separator, Separator));
+    }
+}
+
+TEST_CASE("ignore matcher works properly", "[ignore]")
+{
+    IgnoreMatcher matcher;
+
+    auto ignored = [&matcher](const std::string& path, bool isDirectory) {
+        std::string native = path;
+
+        std::replace(native.begin(), native.end(), '/', Separator);
+
+        return matcher.IsIgnored(native.c_str(), native.size(), isDirectory);
+    };
+
+    SECTION("plain names match at any depth")
+    {
+        matcher.Add("node_modules");
+        matcher.Add("# a comment is skipped");
+        matcher.Add("");
+
+        REQUIRE(matcher.GetSize() == 1);
+
+        REQUIRE(ignored("node_modules", true));
+        REQUIRE(ignored("web/app/node_modules", true));
+        REQUIRE(!ignored("web/node_modules_old", true));
+    }
+
+    SECTION("globs stay within a single directory unless doubled")
+    {
+        matcher.Add("*.log");
+        matcher.Add("/build/*.o");
+        matcher.Add("docs/**/*.md");
+        matcher.Add("data_[0-9]?.csv");
+
+        REQUIRE(ignored("output.log", false));
+        REQUIRE(ignored("deep/down/output.log", false));
+
+        REQUIRE(ignored("build/main.o", false));
+        REQUIRE(!ignored("build/nested/main.o", false));
+        REQUIRE(!ignored("src/build/main.o", false));
+
+        REQUIRE(ignored("docs/readme.md", false));
+        REQUIRE(ignored("docs/a/b/readme.md", false));
+        REQUIRE(!ignored("src/docs/readme.md", false));
+
+        REQUIRE(ignored("data_12.csv", false));
+        REQUIRE(!ignored("data_a2.csv", false));
+    }
+
+    SECTION("directory rules only match directories")
+    {
+        matcher.Add("out/");
+
+        REQUIRE(ignored("out", true));
+        REQUIRE(ignored("src/out", true));
+        REQUIRE(!ignored("out", false));
+    }
+
+    SECTION("the last matching rule wins and negations take paths back")
+    {
+        matcher.Add("*.json");
+        matcher.Add("!package.json");
+
+        REQUIRE(ignored("config.json", false));
+        REQUIRE(!ignored("package.json", false));
+
+        std::string path = "package.json";
+
+        REQUIRE(matcher.Match(path.c_str(), path.size(), false) == IgnoreResult::INCLUDED);
+
+        path = "main.cpp";
+
+        REQUIRE(matcher.Match(path.c_str(), path.size(), false) == IgnoreResult::NONE);
+    }
+
+    SECTION("config ignores are compiled into a matcher")
+    {
+        std::shared_ptr<Config> config = GenerateDefaultConfig();
+
+        REQUIRE(config->GetIgnoreMatcher() == nullptr);
+
+        config->AddIgnored("generated/", true);
+        config->AddIgnored("!generated/keep.cpp", true);
+
+        REQUIRE(config->GetIgnoreMatcher() != nullptr);
+        REQUIRE(config->GetIgnoreMatcher()->GetSize() == 2);
+    }
+}
+
+#ifndef _WIN32
+TEST_CASE("server works properly", "[server]")
+{
+    mkdir("served", 0755);
+    mkdir("served/src", 0755);
+
+    std::ofstream("served/a.cpp") << "int a;\n// a\n";
+    std::ofstream("served/src/b.cpp") << "int b;\n";
+    std::ofstream("served/src/notes") << "plain text\n";
+
+    Server server("served.sock", "served", GenerateDefaultConfig());
+
+    REQUIRE(server.Start());
+
+    // only one server can listen on a socket at a time
+    Server second("served.sock", "served", GenerateDefaultConfig());
+
+    REQUIRE_FALSE(second.Start());
+
+    auto answer = [&server](const std::string& request) {
+        return nlohmann::json::parse(server.Answer(request));
+    };
+
+    SECTION("queries are answered from the counts kept in memory")
+    {
+        nlohmann::json totals = answer("{\"query\": \"totals\", \"path\": \"\"}");
+
+        REQUIRE(totals["ok"] == true);
+        REQUIRE(totals["totals"]["files"] == 3);
+
+        nlohmann::json languages = answer("{\"query\": \"languages\", \"path\": \"src/\"}");
+
+        REQUIRE(languages["totals"]["files"] == 2);
+        REQUIRE(languages["languages"].size() == 2);
+
+        nlohmann::json file = answer("{\"query\": \"file\", \"path\": \"a.cpp\"}");
+
+        REQUIRE(file["file"]["language"] == "C/C++ Source");
+        REQUIRE(file["file"]["code"] == 1);
+        REQUIRE(file["file"]["comment"] == 1);
+
+        // a path with nothing under it has empty totals, while a missing file is an error
+        REQUIRE(answer("{\"query\": \"totals\", \"path\": \"missing\"}")["totals"]["files"] == 0);
+
+        REQUIRE(answer("{\"query\": \"file\", \"path\": \"missing.cpp\"}")["ok"] == false);
+        REQUIRE(answer("{\"query\": \"everything\"}")["ok"] == false);
+        REQUIRE(answer("not json")["ok"] == false);
+
+        // fields of the wrong type are errors too, rather than taking the server down
+        REQUIRE(answer("{\"query\": 1}")["ok"] == false);
+        REQUIRE(answer("{\"query\": \"totals\", \"path\": []}")["ok"] == false);
+    }
+
+    SECTION("queries are framed over the socket")
+    {
+        std::atomic<bool> done(false);
+
+        std::thread serving([&server, &done]() {
+            while (!done)
+            {
+                server.Serve(10);
+            }
+        });
+
+        std::string response;
+
+        REQUIRE(Server::Query("served.sock", "{\"query\": \"totals\", \"path\": \"src\"}", response));
+
+        REQUIRE(nlohmann::json::parse(response)["totals"]["files"] == 2);
+
+        std::string full = GetFSEntry("served/src/b.cpp").fullPath;
+
+        REQUIRE(Server::Query("served.sock", "{\"query\": \"file\", \"path\": \"" + full + "\"}", response));
+
+        REQUIRE(nlohmann::json::parse(response)["file"]["code"] == 1);
+
+        done = true;
+
+        serving.join();
+
+        REQUIRE_FALSE(Server::Query("missing.sock", "{}", response));
+    }
+
+    unlink("served/a.cpp");
+    unlink("served/src/b.cpp");
+    unlink("served/src/notes");
+
+    rmdir("served/src");
+    rmdir("served");
+}
+#endif